@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "arena.h"
+
+
+/* The chunks form a list in the order they were allocated, and an arena
+   fills them front to back. arena_reset() just goes back to the first
+   one, so after a reset the same chunks are filled again before any new
+   one is allocated. A request that doesn't fit in the next chunk gets a
+   new chunk big enough for it, put in ahead of that one.
+*/
+
+void arena_init(Arena *arena, size_t chunk_size){
+    /* Initialize an empty arena. Nothing is allocated until the first allocation */
+    arena->position = NULL;
+    arena->end = NULL;
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK;
+}
+
+
+void arena_free(Arena *arena){
+    /* Free every chunk. Everything allocated from the arena is gone, and
+       the arena is empty again, ready to be reused.
+    */
+    Arena_chunk *chunk = arena->first;
+    while (chunk){
+        Arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena_init(arena, arena->chunk_size);
+}
+
+
+void arena_reset(Arena *arena){
+    /* Drop everything allocated from the arena, in O(1). The chunks are
+       kept and filled again by the next allocations.
+    */
+    arena->current = arena->first;
+    arena->position = arena->first ? arena->first->data : NULL;
+    arena->end = arena->first ? arena->first->data + arena->first->size : NULL;
+}
+
+
+size_t arena_get_capacity(const Arena *arena){
+    size_t capacity = 0;
+    for (const Arena_chunk *chunk = arena->first; chunk; chunk = chunk->next){
+        capacity += chunk->size;
+    }
+    return capacity;
+}
+
+
+void *arena_alloc_slow(Arena *arena, size_t size, size_t alignment){
+    /* The current chunk is full: move on to the next one, if there is one
+       (left over from before a reset) and the request fits in it, or else
+       to a new one. Not meant to be called directly.
+    */
+    if (size > SIZE_MAX - sizeof(Arena_chunk) - alignment){
+        return NULL;
+    }
+    size_t needed = size + alignment - 1;     // enough to align the start of data
+    Arena_chunk *next = arena->current ? arena->current->next : arena->first;
+
+    if (!next || next->size < needed){
+        size_t chunk_size = (needed > arena->chunk_size) ? needed : arena->chunk_size;
+        Arena_chunk *chunk = malloc(sizeof(Arena_chunk) + chunk_size);
+        if (!chunk){
+            return NULL;
+        }
+        chunk->size = chunk_size;
+        chunk->next = next;
+        if (arena->current){
+            arena->current->next = chunk;
+        }
+        else{
+            arena->first = chunk;
+        }
+        next = chunk;
+    }
+    arena->current = next;
+    arena->position = next->data;
+    arena->end = next->data + next->size;
+    return arena_alloc_aligned(arena, size, alignment);     // fits now
+}
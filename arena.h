@@ -0,0 +1,69 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A region (bump) allocator. Allocating moves a pointer forward through
+   the current chunk; nothing is freed on its own. Instead arena_reset()
+   drops everything allocated so far in O(1), keeping the chunks to be
+   filled again, and arena_free() gives the chunks back to malloc.
+
+   That suits data with a common lifetime, like everything built while
+   handling one request: allocate it all from an arena and reset the
+   arena at the end, instead of one free() per object. Elsewhere in the
+   library, str_from_int_arena() and str_dup_arena() allocate from an
+   arena, LL_pool_init_with_arena() makes a node pool carve its slabs
+   out of one, and a StringMap keeps its keys in one.
+
+   An Arena is set up with arena_init() (which allocates nothing) and
+   released with arena_free(). The allocating functions return NULL if
+   malloc fails. An arena isn't thread-safe; give each thread its own,
+   so that none of them needs a lock.
+*/
+#define ARENA_DEFAULT_CHUNK 65536               // bytes per chunk if 0 is passed to arena_init
+#define ARENA_DEFAULT_ALIGN alignof(max_align_t)
+
+typedef struct arena Arena;
+typedef struct arena_chunk Arena_chunk;
+
+struct arena_chunk{
+    Arena_chunk *next;
+    size_t size;        // bytes in data
+    char data[];
+};
+
+struct arena{
+    char *position;         // the next free byte in the current chunk
+    char *end;              // the end of the current chunk
+    Arena_chunk *first;     // the chunks, oldest first
+    Arena_chunk *current;   // the one being filled; NULL before the first allocation
+    size_t chunk_size;      // the size of new chunks, unless an allocation needs a bigger one
+};
+
+void arena_init(Arena *arena, size_t chunk_size);
+void arena_free(Arena *arena);
+void arena_reset(Arena *arena);
+size_t arena_get_capacity(const Arena *arena);      // bytes in all the chunks together
+
+void *arena_alloc_slow(Arena *arena, size_t size, size_t alignment);
+
+static inline void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment){
+    /* size bytes aligned to alignment, which must be a power of 2 */
+    uintptr_t p = ((uintptr_t)arena->position + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (p < (uintptr_t)arena->end && size <= (uintptr_t)arena->end - p){
+        arena->position = (char *)(p + size);
+        return (void *)p;
+    }
+    return arena_alloc_slow(arena, size, alignment);    // on to the next chunk
+}
+
+static inline void *arena_alloc(Arena *arena, size_t size){
+    /* size bytes aligned for any type, like malloc */
+    return arena_alloc_aligned(arena, size, ARENA_DEFAULT_ALIGN);
+}
+
+
+#endif
@@ -0,0 +1,1000 @@
+/* Microbenchmarks for the modules.
+
+   Every benchmark works on an input of a given size in bytes, from 8B up
+   to 64MB (or --max-size), and is repeated until it has run for at least
+   --min-time milliseconds. Each result is reported as ns per operation,
+   input bytes per second and CPU cycles per operation (TSC cycles on x86,
+   left out elsewhere). What counts as one operation is given by the
+   "unit" column: one call for the string scanners, one value for the
+   number and bit functions, one push+pop for the lists.
+
+   The _parallel benchmarks run on a StrPool of --threads threads (one per
+   CPU by default), and in text mode follow their largest size with what
+   each thread did in its last repetition.
+
+   Built with `make INSTRUMENT=1`, the text output ends with the counters
+   and histograms of instrument.h, added up over the whole run.
+
+   usage: bench [--json] [--filter SUBSTRING] [--max-size BYTES] [--min-time MS] [--threads N]
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bit_utils.h"
+#include "instrument.h"
+#include "linked_list.h"
+#include "pstrings.h"
+#include "str_parallel.h"
+#include "str_stream.h"
+#include "string_map.h"
+#include "unrolled_list.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+
+#define MIN_SIZE 8
+#define MAX_SIZE (64UL << 20)
+
+
+static bool json_output = false;
+static bool first_json_result = true;
+static const char *filter = NULL;
+static size_t max_size = MAX_SIZE;
+static double min_time_ns = 50e6;
+static size_t num_threads = 0;
+static StrPool pool;
+static bool pool_started = false;
+
+// results are folded into this so the compiler can't drop the work being timed
+static volatile uint64_t sink;
+
+
+typedef struct bench_timer BenchTimer;
+
+struct bench_timer{
+    uint64_t ns;
+    uint64_t cycles;
+};
+
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+static uint64_t now_cycles(void){
+#if HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+static void timer_start(BenchTimer *start){
+    start->ns = now_ns();
+    start->cycles = now_cycles();
+}
+
+
+static void timer_add_since(BenchTimer *total, const BenchTimer *start){
+    total->cycles += now_cycles() - start->cycles;
+    total->ns += now_ns() - start->ns;
+}
+
+
+/* A benchmark runs one repetition over its input per call and returns how
+   many operations that was. setup() builds the input for a size once;
+   run() may add to the timer itself (and then returns with timed set), for
+   benchmarks that need untimed work between repetitions.
+*/
+typedef struct bench Bench;
+
+struct bench{
+    const char *name;
+    const char *unit;
+    void *(*setup)(size_t size);
+    size_t (*run)(void *input, size_t size, BenchTimer *timer, bool *timed);
+    void (*teardown)(void *input);
+};
+
+
+static bool wanted(const char *name){
+    return !filter || strstr(name, filter);
+}
+
+
+static void report(const Bench *bench, size_t size, size_t ops, const BenchTimer *total, size_t reps){
+    double ns_per_op = (double)total->ns / ops;
+    double bytes_per_s = (double)size * reps / ((double)total->ns / 1e9);
+    double cycles_per_op = (double)total->cycles / ops;
+
+    if (json_output){
+        printf("%s\n    {\"name\": \"%s\", \"size\": %zu, \"unit\": \"%s\", \"ops\": %zu, "
+               "\"ns_per_op\": %.3f, \"bytes_per_s\": %.0f, ",
+               first_json_result ? "" : ",", bench->name, size, bench->unit, ops, ns_per_op, bytes_per_s);
+        if (HAVE_TSC){
+            printf("\"cycles_per_op\": %.2f}", cycles_per_op);
+        }
+        else{
+            printf("\"cycles_per_op\": null}");
+        }
+        first_json_result = false;
+    }
+    else{
+        printf("%-24s %10zu  %-6s %12.2f ns/op %10.1f MB/s", bench->name, size, bench->unit, ns_per_op, bytes_per_s / 1e6);
+        if (HAVE_TSC){
+            printf(" %10.1f cycles/op", cycles_per_op);
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+
+static void run_bench(const Bench *bench){
+    if (!wanted(bench->name)){
+        return;
+    }
+    for (size_t size = MIN_SIZE; size <= max_size; size *= 8){
+        void *input = bench->setup(size);
+        BenchTimer total = {0, 0};
+        size_t ops = 0;
+        size_t reps = 0;
+
+        if (!input){
+            fprintf(stderr, "%s: out of memory at size %zu\n", bench->name, size);
+            return;
+        }
+        bench->run(input, size, &total, &(bool){false});     // warm up
+        total.ns = 0;
+        total.cycles = 0;
+        size_t batch = 1;
+        while (total.ns < min_time_ns){
+            // time a batch of repetitions at once, growing it until reading the clock is noise
+            BenchTimer start;
+            bool timed = false;
+            uint64_t before = total.ns;
+            timer_start(&start);
+            for (size_t i = 0; i < batch; i++){
+                ops += bench->run(input, size, &total, &timed);
+            }
+            if (!timed){
+                timer_add_since(&total, &start);
+            }
+            reps += batch;
+            if (total.ns - before < min_time_ns / 64){
+                batch *= 2;
+            }
+        }
+        report(bench, size, ops, &total, reps);
+        bench->teardown(input);
+
+        if (size < max_size && size * 8 > max_size){
+            size = max_size / 8;    // end on max_size itself
+        }
+    }
+}
+
+
+
+/*                              * * *
+   INPUTS
+*/
+
+static char *make_string(size_t size){
+    /* size - 1 letters and a NUL */
+    char *s = malloc(size);
+    if (s){
+        for (size_t i = 0; i + 1 < size; i++){
+            s[i] = 'a' + i % 26;
+        }
+        s[size - 1] = '\0';
+    }
+    return s;
+}
+
+
+static uint64_t next_random(uint64_t *state){
+    // xorshift64
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+
+typedef struct numbers Numbers;
+
+struct numbers{
+    char *text;         // the numbers, each followed by a NUL
+    size_t *offsets;    // where each one starts
+    long *values;
+    size_t count;
+};
+
+
+static void *setup_numbers(size_t size){
+    /* About size bytes of NUL-separated decimal numbers of varying length,
+       and the same numbers as longs. Always at least one.
+    */
+    Numbers *numbers = malloc(sizeof(Numbers));
+    size_t capacity = size / 4 + 1;
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+    numbers->text = malloc(size + STR_FORMAT_LONG_MAX);
+    numbers->offsets = malloc(capacity * sizeof(size_t));
+    numbers->values = malloc(capacity * sizeof(long));
+    numbers->count = 0;
+    size_t position = 0;
+    while (numbers->count == 0 || position + STR_FORMAT_LONG_MAX <= size){
+        uint64_t r = next_random(&state);
+        long value = (long)(r >> (r % 60 + 1));     // anything from 1 to 19 digits
+        if (r & 1){
+            value = -value;
+        }
+        numbers->offsets[numbers->count] = position;
+        numbers->values[numbers->count] = value;
+        position += str_format_long(numbers->text + position, value) + 1;
+        numbers->count++;
+        if (numbers->count == capacity){
+            break;
+        }
+    }
+    return numbers;
+}
+
+
+static void teardown_numbers(void *input){
+    Numbers *numbers = input;
+    free(numbers->text);
+    free(numbers->offsets);
+    free(numbers->values);
+    free(numbers);
+}
+
+
+typedef struct tokens Tokens;
+
+struct tokens{
+    char *original;
+    char *scratch;  // str_tokenize writes into its input, so each repetition gets a fresh copy
+    size_t size;
+};
+
+
+static void *setup_tokens(size_t size){
+    /* size - 1 chars of 7-letter fields separated by ',' */
+    Tokens *tokens = malloc(sizeof(Tokens));
+    tokens->original = make_string(size);
+    tokens->scratch = malloc(size);
+    tokens->size = size;
+    for (size_t i = 7; i + 1 < size; i += 8){
+        tokens->original[i] = ',';
+    }
+    return tokens;
+}
+
+
+static void teardown_tokens(void *input){
+    Tokens *tokens = input;
+    free(tokens->original);
+    free(tokens->scratch);
+    free(tokens);
+}
+
+
+typedef struct words Words;
+
+struct words{
+    long long *values;
+    char *text;     // room for get_binary_string's output
+    size_t count;
+};
+
+
+static void *setup_words(size_t size){
+    /* size / 8 random values (at least one) */
+    Words *words = malloc(sizeof(Words));
+    uint64_t state = 0x2545F4914F6CDD1DULL;
+
+    words->count = (size < 8) ? 1 : size / 8;
+    words->values = malloc(words->count * sizeof(long long));
+    words->text = malloc(BIT_BINARY_MAX);
+    for (size_t i = 0; i < words->count; i++){
+        // keep them positive and below 2^62 so Reverse_bits has room for its sentinel
+        words->values[i] = (long long)(next_random(&state) >> 2);
+    }
+    return words;
+}
+
+
+static void teardown_words(void *input){
+    Words *words = input;
+    free(words->values);
+    free(words->text);
+    free(words);
+}
+
+
+typedef struct keys Keys;
+
+struct keys{
+    char *text;
+    const char **keys;
+    size_t *lengths;
+    void **values;
+    size_t count;
+    StringMap map;      // holding every key
+};
+
+
+static void *setup_keys(size_t size){
+    /* size / 16 (at least one) distinct keys of 8 to 15 chars, and a map of them */
+    Keys *keys = malloc(sizeof(Keys));
+    keys->count = (size < 16) ? 1 : size / 16;
+    keys->text = malloc(keys->count * 16);
+    keys->keys = malloc(keys->count * sizeof(char *));
+    keys->lengths = malloc(keys->count * sizeof(size_t));
+    keys->values = malloc(keys->count * sizeof(void *));
+    SM_init(&keys->map, keys->count);
+    for (size_t i = 0; i < keys->count; i++){
+        char *key = keys->text + i * 16;
+        keys->lengths[i] = (size_t)sprintf(key, "key:%0*zu", (int)(4 + i % 8), i);
+        keys->keys[i] = key;
+        SM_put(&keys->map, key, keys->lengths[i], key);
+    }
+    return keys;
+}
+
+
+static void teardown_keys(void *input){
+    Keys *keys = input;
+    SM_destroy(&keys->map);
+    free(keys->text);
+    free(keys->keys);
+    free(keys->lengths);
+    free(keys->values);
+    free(keys);
+}
+
+
+typedef struct number_file NumberFile;
+
+struct number_file{
+    char path[32];
+    long *values;   // room for all of them
+    size_t count;
+};
+
+
+static void *setup_number_file(size_t size){
+    /* The numbers of setup_numbers(), one per line, in a temporary file */
+    NumberFile *file = malloc(sizeof(NumberFile));
+    Numbers *numbers = setup_numbers(size);
+    size_t length = numbers->offsets[numbers->count - 1];
+
+    length += strlen(numbers->text + length) + 1;
+    for (size_t i = 0; i < length; i++){
+        if (numbers->text[i] == '\0'){
+            numbers->text[i] = '\n';
+        }
+    }
+    strcpy(file->path, "/tmp/bench_numbers_XXXXXX");
+    int fd = mkstemp(file->path);
+    if (fd < 0 || write(fd, numbers->text, length) != (ssize_t)length){
+        perror("bench: can't write the numbers file");
+        exit(1);
+    }
+    close(fd);
+    file->count = numbers->count;
+    file->values = malloc(numbers->count * sizeof(long));
+    teardown_numbers(numbers);
+    return file;
+}
+
+
+static void teardown_number_file(void *input){
+    NumberFile *file = input;
+    unlink(file->path);
+    free(file->values);
+    free(file);
+}
+
+
+typedef struct number_list NumberList;
+
+struct number_list{
+    char *text;         // the numbers of setup_numbers(), comma-separated
+    size_t length;
+    long *values;
+    size_t count;
+    size_t size;
+};
+
+
+static void *setup_number_list(size_t size){
+    /* Starts the pool too, the first time it's needed */
+    if (!pool_started && !str_pool_init(&pool, num_threads)){
+        return NULL;
+    }
+    pool_started = true;
+
+    NumberList *list = malloc(sizeof(NumberList));
+    Numbers *numbers = setup_numbers(size);
+    size_t length = numbers->offsets[numbers->count - 1];
+
+    length += strlen(numbers->text + length);
+    for (size_t i = 0; i < length; i++){
+        if (numbers->text[i] == '\0'){
+            numbers->text[i] = ',';
+        }
+    }
+    list->text = numbers->text;
+    list->length = length;
+    list->values = numbers->values;
+    list->count = numbers->count;
+    list->size = size;
+    free(numbers->offsets);
+    free(numbers);
+    return list;
+}
+
+
+static void teardown_number_list(void *input){
+    NumberList *list = input;
+    free(list->text);
+    free(list->values);
+    free(list);
+}
+
+
+static void teardown_number_list_parallel(void *input){
+    /* After the largest size, print what each thread did in the last repetition */
+    NumberList *list = input;
+    if (!json_output && list->size * 8 > max_size){
+        for (size_t t = 0; t < str_pool_get_num_threads(&pool); t++){
+            const StrPoolStats *stats = str_pool_get_stats(&pool, t);
+            printf("    thread %-3zu %10zu chunks (%zu stolen) %12zu values %10.1f MB/s\n", t, stats->chunks,
+                   stats->chunks_stolen, stats->values, str_pool_stats_get_throughput(stats) / 1e6);
+        }
+    }
+    teardown_number_list(list);
+}
+
+
+static void *setup_string(size_t size){
+    return make_string(size);
+}
+
+
+static void *setup_string_pair(size_t size){
+    /* Two equal strings in one allocation, so str_compare has to go to the end */
+    char *pair = malloc(2 * size);
+    if (pair){
+        char *s = make_string(size);
+        memcpy(pair, s, size);
+        memcpy(pair + size, s, size);
+        free(s);
+    }
+    return pair;
+}
+
+
+static void *setup_nothing(size_t size){
+    (void)size;
+    return malloc(1);
+}
+
+
+
+/*                              * * *
+   BENCHMARKS
+*/
+
+static size_t run_str_len(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)size, (void)timer, (void)timed;
+    sink += str_len(input);
+    return 1;
+}
+
+
+static size_t run_str_compare(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)timer, (void)timed;
+    char *pair = input;
+    sink += str_compare(pair, pair + size);
+    return 1;
+}
+
+
+static size_t run_str_is_same_n(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)timer, (void)timed;
+    char *pair = input;
+    sink += str_is_same_n(pair, size - 1, pair + size, size - 1);
+    return 1;
+}
+
+
+static size_t run_str_hash_n(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)timer, (void)timed;
+    sink += str_hash_n(input, size - 1, 0);
+    return 1;
+}
+
+
+static size_t run_str_rev_n(void *input, size_t size, BenchTimer *timer, bool *timed){
+    /* Reverse the first string of the pair into the second */
+    (void)timer, (void)timed;
+    char *pair = input;
+    str_rev_n(pair, size - 1, pair + size);
+    sink += pair[size];
+    return 1;
+}
+
+
+static size_t run_str_rev_ip_n(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)timer, (void)timed;
+    char *s = input;
+    str_rev_ip_n(s, size - 1);
+    sink += s[0];
+    return 1;
+}
+
+
+static size_t run_str_to_lower_ip_n(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)timer, (void)timed;
+    char *s = input;
+    str_to_lower_ip_n(s, size - 1);
+    sink += s[0];
+    return 1;
+}
+
+
+static size_t run_str_is_same_nocase_n(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)timer, (void)timed;
+    char *pair = input;
+    sink += str_is_same_nocase_n(pair, size - 1, pair + size, size - 1);
+    return 1;
+}
+
+
+static size_t run_str_hash_nocase_n(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)timer, (void)timed;
+    sink += str_hash_nocase_n(input, size - 1, 0);
+    return 1;
+}
+
+
+static size_t run_str_find_short(void *input, size_t size, BenchTimer *timer, bool *timed){
+    /* A needle that is never there, so the whole string is searched */
+    (void)timer, (void)timed;
+    sink += (uintptr_t)str_find_n(input, size - 1, "qrstuvwxyzq", 11);
+    return 1;
+}
+
+
+static size_t run_str_find_long(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)timer, (void)timed;
+    static const char needle[] = "abcdefghijklmnopqrstuvwxyzabcdefghijklmX";
+    sink += (uintptr_t)str_find_n(input, size - 1, needle, sizeof(needle) - 1);
+    return 1;
+}
+
+
+static size_t run_str_matcher_find(void *input, size_t size, BenchTimer *timer, bool *timed){
+    /* Six keywords, none of which is there */
+    (void)timer, (void)timed;
+    static const char *const keywords[] = {"error", "warning", "fatal", "panic", "timeout", "refused"};
+    static const size_t lengths[] = {5, 7, 5, 5, 7, 7};
+    static StrMatcher matcher;
+    static bool compiled = false;
+    StrMatch match;
+
+    if (!compiled){
+        str_matcher_init(&matcher, keywords, lengths, 6);
+        compiled = true;
+    }
+    sink += str_matcher_find(&matcher, input, size - 1, &match);
+    return 1;
+}
+
+
+static size_t run_str_to_int(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)size, (void)timer, (void)timed;
+    Numbers *numbers = input;
+    long total = 0;
+    for (size_t i = 0; i < numbers->count; i++){
+        total += str_to_int(numbers->text + numbers->offsets[i]);
+    }
+    sink += total;
+    return numbers->count;
+}
+
+
+static size_t run_str_from_int(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)size, (void)timer, (void)timed;
+    Numbers *numbers = input;
+    for (size_t i = 0; i < numbers->count; i++){
+        char *s = str_from_int(numbers->values[i]);
+        sink += s[0];
+        free(s);
+    }
+    return numbers->count;
+}
+
+
+static size_t run_str_from_int_arena(void *input, size_t size, BenchTimer *timer, bool *timed){
+    /* Like str_from_int, with one arena_reset() instead of a free per string */
+    (void)size, (void)timer, (void)timed;
+    Numbers *numbers = input;
+    Arena arena;
+    arena_init(&arena, 0);
+    for (size_t i = 0; i < numbers->count; i++){
+        char *s = str_from_int_arena(numbers->values[i], &arena);
+        sink += s[0];
+    }
+    arena_free(&arena);
+    return numbers->count;
+}
+
+
+static size_t run_str_format_long(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)size, (void)timer, (void)timed;
+    Numbers *numbers = input;
+    char buf[STR_FORMAT_LONG_MAX];
+    for (size_t i = 0; i < numbers->count; i++){
+        sink += str_format_long(buf, numbers->values[i]);
+    }
+    return numbers->count;
+}
+
+
+static size_t run_str_builder(void *input, size_t size, BenchTimer *timer, bool *timed){
+    /* Build one line of all the values, comma-separated, growing from empty */
+    (void)size, (void)timer, (void)timed;
+    Numbers *numbers = input;
+    StrBuilder builder;
+    str_builder_init(&builder);
+    for (size_t i = 0; i < numbers->count; i++){
+        str_builder_append_long(&builder, numbers->values[i]);
+        str_builder_append_char(&builder, ',');
+    }
+    sink += str_builder_len(&builder);
+    str_builder_free(&builder);
+    return numbers->count;
+}
+
+
+static size_t run_str_stream_mmap(void *input, size_t size, BenchTimer *timer, bool *timed){
+    /* Open, mmap and parse the whole file */
+    (void)size, (void)timer, (void)timed;
+    NumberFile *file = input;
+    StrStream stream;
+    size_t count = 0;
+
+    if (str_stream_open_file(&stream, file->path, '\n')){
+        count = str_stream_parse_longs(&stream, file->values, file->count, NULL);
+        str_stream_close(&stream);
+    }
+    sink += count;
+    return file->count;
+}
+
+
+static size_t run_str_stream_read(void *input, size_t size, BenchTimer *timer, bool *timed){
+    /* The same through read() and the default buffer */
+    (void)size, (void)timer, (void)timed;
+    NumberFile *file = input;
+    StrStream stream;
+    size_t count = 0;
+    int fd = open(file->path, O_RDONLY);
+
+    if (fd >= 0 && str_stream_open_fd(&stream, fd, 0, '\n')){
+        count = str_stream_parse_longs(&stream, file->values, file->count, NULL);
+        str_stream_close(&stream);
+    }
+    if (fd >= 0){
+        close(fd);
+    }
+    sink += count;
+    return file->count;
+}
+
+
+static size_t run_str_parse_longs(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)size, (void)timer, (void)timed;
+    NumberList *list = input;
+    sink += str_parse_longs(list->text, list->length, ',', list->values, list->count, NULL, NULL);
+    return list->count;
+}
+
+
+static size_t run_str_parse_longs_parallel(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)size, (void)timer, (void)timed;
+    NumberList *list = input;
+    sink += str_parse_longs_parallel(&pool, list->text, list->length, ',', list->values, list->count, NULL, NULL);
+    return list->count;
+}
+
+
+static size_t run_str_format_longs_parallel(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)size, (void)timer, (void)timed;
+    NumberList *list = input;
+    sink += str_format_longs_parallel(&pool, list->text, list->length + 1, list->values, list->count, ',', NULL);
+    return list->count;
+}
+
+
+static size_t run_str_tokenize(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)size;
+    Tokens *tokens = input;
+    BenchTimer start;
+    size_t count = 0;
+
+    memcpy(tokens->scratch, tokens->original, tokens->size);   // not timed
+    timer_start(&start);
+    for (char *token = str_tokenize(tokens->scratch, ','); token; token = str_tokenize(NULL, ',')){
+        count++;
+    }
+    timer_add_since(timer, &start);
+    *timed = true;
+    sink += count;
+    return count;
+}
+
+
+static size_t run_str_tokenizer(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)timer, (void)timed;
+    Tokens *tokens = input;
+    StrTokenizer tokenizer;
+    StrToken token;
+    size_t count = 0;
+
+    str_tokenizer_init(&tokenizer, tokens->original, size - 1, ',');
+    while (str_tokenizer_next(&tokenizer, &token)){
+        count++;
+    }
+    sink += count;
+    return count;
+}
+
+
+static size_t run_count_bits(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)size, (void)timer, (void)timed;
+    Words *words = input;
+    uint64_t total = 0;
+    for (size_t i = 0; i < words->count; i++){
+        total += Count_bits(words->values[i]);
+    }
+    sink += total;
+    return words->count;
+}
+
+
+static size_t run_reverse_bits(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)size, (void)timer, (void)timed;
+    Words *words = input;
+    uint64_t total = 0;
+    for (size_t i = 0; i < words->count; i++){
+        total += (uint64_t)Reverse_bits(words->values[i]);
+    }
+    sink += total;
+    return words->count;
+}
+
+
+static size_t run_get_binary_string(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)size, (void)timer, (void)timed;
+    Words *words = input;
+    for (size_t i = 0; i < words->count; i++){
+        get_binary_string(words->text, words->values[i]);
+        sink += words->text[1];
+    }
+    return words->count;
+}
+
+
+static size_t run_ll_push_pop(void *input, size_t size, BenchTimer *timer, bool *timed){
+    /* Append size chars, then pop them all from the head */
+    (void)input, (void)timer, (void)timed;
+    LinkedList list;
+    LL_init(&list);
+    for (size_t i = 0; i < size; i++){
+        LL_append(&list, (char)i);
+    }
+    for (size_t i = 0; i < size; i++){
+        sink += LL_head_pop(&list);
+    }
+    return size;
+}
+
+
+static size_t run_ll_pooled_push_pop(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)input, (void)timer, (void)timed;
+    LinkedList_pool pool;
+    LinkedList list;
+    LL_pool_init(&pool, 0);
+    LL_init_with_pool(&list, &pool);
+    for (size_t i = 0; i < size; i++){
+        LL_append(&list, (char)i);
+    }
+    for (size_t i = 0; i < size; i++){
+        sink += LL_head_pop(&list);
+    }
+    LL_pool_destroy(&pool);
+    return size;
+}
+
+
+static size_t run_ull_push_pop(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)input, (void)timer, (void)timed;
+    UnrolledList list;
+    ULL_init(&list);
+    for (size_t i = 0; i < size; i++){
+        ULL_append(&list, (char)i);
+    }
+    for (size_t i = 0; i < size; i++){
+        sink += ULL_head_pop(&list);
+    }
+    ULL_destroy(&list);
+    return size;
+}
+
+
+static size_t run_sm_put(void *input, size_t size, BenchTimer *timer, bool *timed){
+    /* Build a map of all the keys from empty */
+    (void)size, (void)timer, (void)timed;
+    Keys *keys = input;
+    StringMap map;
+    SM_init(&map, 0);
+    for (size_t i = 0; i < keys->count; i++){
+        SM_put(&map, keys->keys[i], keys->lengths[i], NULL);
+    }
+    sink += SM_get_num_items(&map);
+    SM_destroy(&map);
+    return keys->count;
+}
+
+
+static size_t run_sm_get(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)size, (void)timer, (void)timed;
+    Keys *keys = input;
+    size_t found = 0;
+    for (size_t i = 0; i < keys->count; i++){
+        void *value;
+        found += SM_get(&keys->map, keys->keys[i], keys->lengths[i], &value);
+    }
+    sink += found;
+    return keys->count;
+}
+
+
+static size_t run_sm_get_many(void *input, size_t size, BenchTimer *timer, bool *timed){
+    (void)size, (void)timer, (void)timed;
+    Keys *keys = input;
+    sink += SM_get_many(&keys->map, keys->keys, keys->lengths, keys->count, keys->values, NULL);
+    return keys->count;
+}
+
+
+static const Bench benches[] = {
+    {"str_len", "call", setup_string, run_str_len, free},
+    {"str_compare", "call", setup_string_pair, run_str_compare, free},
+    {"str_is_same_n", "call", setup_string_pair, run_str_is_same_n, free},
+    {"str_hash_n", "call", setup_string, run_str_hash_n, free},
+    {"str_rev_n", "call", setup_string_pair, run_str_rev_n, free},
+    {"str_rev_ip_n", "call", setup_string, run_str_rev_ip_n, free},
+    {"str_to_lower_ip_n", "call", setup_string, run_str_to_lower_ip_n, free},
+    {"str_is_same_nocase_n", "call", setup_string_pair, run_str_is_same_nocase_n, free},
+    {"str_hash_nocase_n", "call", setup_string, run_str_hash_nocase_n, free},
+    {"str_find_short", "call", setup_string, run_str_find_short, free},
+    {"str_find_long", "call", setup_string, run_str_find_long, free},
+    {"str_matcher_find", "call", setup_string, run_str_matcher_find, free},
+    {"str_to_int", "value", setup_numbers, run_str_to_int, teardown_numbers},
+    {"str_from_int", "value", setup_numbers, run_str_from_int, teardown_numbers},
+    {"str_from_int_arena", "value", setup_numbers, run_str_from_int_arena, teardown_numbers},
+    {"str_format_long", "value", setup_numbers, run_str_format_long, teardown_numbers},
+    {"str_parse_longs", "value", setup_number_list, run_str_parse_longs, teardown_number_list},
+    {"str_parse_longs_parallel", "value", setup_number_list, run_str_parse_longs_parallel, teardown_number_list_parallel},
+    {"str_format_longs_parallel", "value", setup_number_list, run_str_format_longs_parallel, teardown_number_list_parallel},
+    {"str_builder", "value", setup_numbers, run_str_builder, teardown_numbers},
+    {"str_stream_mmap", "value", setup_number_file, run_str_stream_mmap, teardown_number_file},
+    {"str_stream_read", "value", setup_number_file, run_str_stream_read, teardown_number_file},
+    {"str_tokenize", "token", setup_tokens, run_str_tokenize, teardown_tokens},
+    {"str_tokenizer_next", "token", setup_tokens, run_str_tokenizer, teardown_tokens},
+    {"Count_bits", "value", setup_words, run_count_bits, teardown_words},
+    {"Reverse_bits", "value", setup_words, run_reverse_bits, teardown_words},
+    {"get_binary_string", "value", setup_words, run_get_binary_string, teardown_words},
+    {"SM_put", "key", setup_keys, run_sm_put, teardown_keys},
+    {"SM_get", "key", setup_keys, run_sm_get, teardown_keys},
+    {"SM_get_many", "key", setup_keys, run_sm_get_many, teardown_keys},
+    {"LL_push_pop", "item", setup_nothing, run_ll_push_pop, free},
+    {"LL_pooled_push_pop", "item", setup_nothing, run_ll_pooled_push_pop, free},
+    {"ULL_push_pop", "item", setup_nothing, run_ull_push_pop, free},
+};
+
+
+
+static void print_instrumentation(void){
+    /* The totals for the whole run, and the median and 99th percentile of
+       each histogram (as bucket bounds)
+    */
+    InstrSnapshot snapshot;
+    instr_get_snapshot(&snapshot);
+
+    printf("\ninstrumentation (%zu threads)\n", snapshot.num_threads);
+    for (size_t c = 0; c < INSTR_NUM_COUNTERS; c++){
+        printf("  %-24s %16llu\n", instr_counter_name(c), (unsigned long long)snapshot.counters[c]);
+    }
+    for (size_t h = 0; h < INSTR_NUM_HISTOGRAMS; h++){
+        const InstrHistogram *histogram = &snapshot.histograms[h];
+        printf("  %-24s %16llu values %20llu total  p50 <= %llu  p99 <= %llu\n", instr_histogram_name(h),
+               (unsigned long long)histogram->count, (unsigned long long)histogram->sum,
+               (unsigned long long)instr_histogram_percentile(histogram, 50),
+               (unsigned long long)instr_histogram_percentile(histogram, 99));
+    }
+}
+
+
+static void usage(const char *program){
+    fprintf(stderr, "usage: %s [--json] [--filter SUBSTRING] [--max-size BYTES] [--min-time MS] [--threads N]\n", program);
+    exit(2);
+}
+
+
+int main(int argc, char *argv[]){
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--json") == 0){
+            json_output = true;
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc){
+            filter = argv[++i];
+        }
+        else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc){
+            max_size = strtoul(argv[++i], NULL, 10);
+            if (max_size < MIN_SIZE){
+                max_size = MIN_SIZE;
+            }
+        }
+        else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc){
+            min_time_ns = strtod(argv[++i], NULL) * 1e6;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+            num_threads = strtoul(argv[++i], NULL, 10);
+        }
+        else{
+            usage(argv[0]);
+        }
+    }
+
+    if (json_output){
+        printf("{\"tsc\": %s, \"results\": [", HAVE_TSC ? "true" : "false");
+    }
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++){
+        run_bench(&benches[i]);
+    }
+    if (json_output){
+        printf("\n]}\n");
+    }
+    else if (instr_is_enabled()){
+        print_instrumentation();
+    }
+    if (pool_started){
+        str_pool_destroy(&pool);
+    }
+    return 0;
+}
@@ -1,21 +1,21 @@
 
 #include "bit_utils.h"
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include "cpu_features.h"
+#include "instrument.h"
 
 
 
 uint8_t Count_bits(long long num){
 /* Count and return the number of bits in num.
 
-   num can be any integer type <= long long.
+   num can be any integer type <= long long. A negative num is
+   counted as its two's complement bit pattern, so it always has 64 bits.
 */
-    uint8_t count = 0;
-
-    while (num){
-        count++;
-        num >>= 1;
-    }
-    return count;
+    INSTR_COUNT(INSTR_BIT_CALLS, 1);
+    return bit_length64((unsigned long long)num);
 };
 
 
@@ -39,17 +39,23 @@ long long Reverse_bits(long long num){
         while (reversed > 1){ // stop at the last bit
             // do something
         }
+
+   The sentinel needs a bit of its own, so num has to fit in 62 bits
+   for the result to be meaningful. bit_reverse64() reverses all 64
+   bits of a value without one.
 */
-    long long reversed = 1; // the leftmost 1 serves as a Sentinel Value 
-    uint8_t tmp = 0;
-    
-    while (num){
-        tmp = num & 1;    
-        reversed <<= 1;
-        reversed += tmp;
-        num >>= 1;
+    unsigned long long bits = num;  // unsigned, so that the shifts below bring in 0s
+    unsigned length = bit_length64(bits);
+
+    INSTR_COUNT(INSTR_BIT_CALLS, 1);
+    if (length == 0){
+        return 1;   // just the sentinel
     }
-    return reversed;
+    if (length == 64){
+        return (long long)bit_reverse64(bits);  // no room left for the sentinel
+    }
+    // reverse all 64 bits, drop the leading zeros that ended up at the bottom, then add the sentinel
+    return (long long)((bit_reverse64(bits) >> (64 - length)) | (1ULL << length));
 }
 
 
@@ -74,34 +80,349 @@ void get_binary_string(char *holding_string, long long number_to_convert){
 
    holding_string should be (at least) of length equal to the number of bits in number_to_convert +1
    (for the terminating NULL). This value could, for example, be obtained with a call to Count_bits().
+   0 is written as "0", so it needs 2 chars. A negative number is written as its
+   64-bit two's complement pattern, so it needs 65.
+
+   The string is NUL-terminated. bit_format_binary() does the same for a fixed
+   width, and returns the length.
+*/
+    unsigned width = bit_length64((unsigned long long)number_to_convert);
+    INSTR_COUNT(INSTR_BIT_CALLS, 1);
+    bit_format_binary(holding_string, (unsigned long long)number_to_convert, width ? width : 1);
+}
+
+
+
+/*                              * * *
+   FIXED-WIDTH BIT PRIMITIVES
+
+   Each operation has an 8, 16, 32 and 64-bit variant; the narrower ones are
+   the 64-bit one applied to a zero-extended value, plus a shift where the
+   width matters.
+
+   Popcount is the one that's picked at runtime: the 64-bit version uses
+   the POPCNT instruction when the CPU has it, and a SWAR count otherwise.
+   The compiler builtins for it fall back to a library call unless the
+   whole program is built for POPCNT, so this matters.
+   clz/ctz use the compiler builtins, which are a single BSR/BSF when the
+   program isn't built for LZCNT/TZCNT (-mlzcnt/-mbmi) and the instructions
+   themselves when it is; either way the only extra work is the zero check.
+   Bit reversal swaps ever smaller groups of bits inside each byte with
+   masks, then reverses the byte order with a byte swap.
+*/
+
+static unsigned popcount64_swar(uint64_t x){
+    x = x - ((x >> 1) & 0x5555555555555555ULL);                             // 2-bit counts
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);  // 4-bit counts
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;                             // 8-bit counts
+    return (unsigned)((x * 0x0101010101010101ULL) >> 56);                  // sum of the bytes, in the top byte
+}
+
+
+#if CPU_X86_DISPATCH
+CPU_TARGET("popcnt")
+static unsigned popcount64_hw(uint64_t x){
+    return (unsigned)__builtin_popcountll(x);
+}
+#endif
+
+
+#if defined(__POPCNT__)
+// built for POPCNT anyway, so there's nothing to pick
+static unsigned (*popcount64_kernel)(uint64_t) = popcount64_hw;
+#else
+static unsigned (*popcount64_kernel)(uint64_t) = popcount64_swar;
+#endif
+
+
+CPU_CONSTRUCTOR
+static void bit_init_kernels(void){
+#if CPU_X86_DISPATCH
+    if (cpu_has_popcnt()){
+        popcount64_kernel = popcount64_hw;
+    }
+#endif
+}
+
+
+unsigned bit_popcount64(uint64_t x){
+    /* Return the number of set bits in x */
+    return popcount64_kernel(x);
+}
+
+unsigned bit_popcount32(uint32_t x){
+    return popcount64_kernel(x);
+}
+
+unsigned bit_popcount16(uint16_t x){
+    return popcount64_kernel(x);
+}
+
+unsigned bit_popcount8(uint8_t x){
+    return popcount64_kernel(x);
+}
+
+
+
+unsigned bit_clz64(uint64_t x){
+    /* Return the number of 0 bits above the highest set bit in x, or 64 if x is 0 */
+    if (x == 0){
+        return 64;
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_clzll(x);
+#else
+    unsigned n = 0;
+    // halve the search space each step
+    for (unsigned shift = 32; shift; shift >>= 1){
+        if (!(x >> (64 - shift))){
+            n += shift;
+            x <<= shift;
+        }
+    }
+    return n;
+#endif
+}
+
+unsigned bit_clz32(uint32_t x){
+    return bit_clz64(x) - 32;
+}
+
+unsigned bit_clz16(uint16_t x){
+    return bit_clz64(x) - 48;
+}
+
+unsigned bit_clz8(uint8_t x){
+    return bit_clz64(x) - 56;
+}
+
+
+
+unsigned bit_ctz64(uint64_t x){
+    /* Return the number of 0 bits below the lowest set bit in x, or 64 if x is 0 */
+    if (x == 0){
+        return 64;
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(x);
+#else
+    // x & -x isolates the lowest set bit; the bits below it become the count
+    return popcount64_swar((x & (0 - x)) - 1);
+#endif
+}
+
+// a 0 of a narrower type has to report that type's width, not 64
+
+unsigned bit_ctz32(uint32_t x){
+    return x ? bit_ctz64(x) : 32;
+}
+
+unsigned bit_ctz16(uint16_t x){
+    return x ? bit_ctz64(x) : 16;
+}
+
+unsigned bit_ctz8(uint8_t x){
+    return x ? bit_ctz64(x) : 8;
+}
+
 
-                                        * * *
 
-   NOTES
+unsigned bit_length64(uint64_t x){
+    /* Return the number of bits needed to hold x, i.e. the position of
+       its highest set bit plus one. 0 needs 0 bits.
+    */
+    return 64 - bit_clz64(x);
+}
+
+unsigned bit_length32(uint32_t x){
+    return bit_length64(x);
+}
+
+unsigned bit_length16(uint16_t x){
+    return bit_length64(x);
+}
+
+unsigned bit_length8(uint8_t x){
+    return bit_length64(x);
+}
+
+
+
+static uint64_t byte_swap64(uint64_t x){
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap64(x);
+#else
+    x = ((x & 0x00000000FFFFFFFFULL) << 32) | (x >> 32);
+    x = ((x & 0x0000FFFF0000FFFFULL) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFULL);
+    return ((x & 0x00FF00FF00FF00FFULL) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFULL);
+#endif
+}
+
+
+uint64_t bit_reverse64(uint64_t x){
+    /* Return x with its 64 bits in reverse order: bit 0 becomes bit 63 and
+       so on. Unlike Reverse_bits, leading zeros are reversed too, and there's
+       no sentinel bit.
+    */
+    x = ((x & 0x5555555555555555ULL) << 1) | ((x >> 1) & 0x5555555555555555ULL);   // swap adjacent bits
+    x = ((x & 0x3333333333333333ULL) << 2) | ((x >> 2) & 0x3333333333333333ULL);   // swap pairs
+    x = ((x & 0x0F0F0F0F0F0F0F0FULL) << 4) | ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL);   // swap nibbles
+    return byte_swap64(x);
+}
+
+uint32_t bit_reverse32(uint32_t x){
+    return (uint32_t)(bit_reverse64(x) >> 32);
+}
+
+uint16_t bit_reverse16(uint16_t x){
+    return (uint16_t)(bit_reverse64(x) >> 48);
+}
+
+uint8_t bit_reverse8(uint8_t x){
+    return (uint8_t)(bit_reverse64(x) >> 56);
+}
+
+
+
+/*                              * * *
+   BINARY / HEX FORMATTING
 
-   tmp below is converted from an integer with a value of 1 or 0 to a char, i.e. from 1 to '1' or 0 to '0'. 
-   This is done by adding tmp up with '0'.
-   
-   This takes advantage of the fact that ASCII's character set has consecutive number values for 
-   representing the '0', '1','2','3'..'9' characters. This means that '5''s value is 5 places 
-   from '0's value, i.e. '0' + 5. 
-   0' + tmp (which is 1 or 0) will get the ASCII value for '1' or '0'.
+   Binary digits are produced a byte at a time without a loop over the bits:
+   multiplying the byte by 0x0101010101010101 puts a copy of it in every byte
+   of a word, masking keeps one bit per copy (the highest bit in the first
+   char, down to the lowest in the last), and adding 0x7F to each byte carries
+   exactly the bytes that kept a bit into their top bit. That depends on the
+   byte order, so big-endian builds write the bits one at a time instead.
+   Hex digits come from a 16-char table, one lookup per nibble.
 */
-    uint8_t ind = 0 ; 
-    uint8_t tmp = 0;  
-    char to_add; // tmp converted to a char --> '0' or '1'
-    
-    number_to_convert = Reverse_bits(number_to_convert);    // reverse the bits in number_to_convert first
 
-    do {
-        tmp = number_to_convert & 1;  
-	    to_add = tmp + '0';  
-        holding_string[ind] = to_add;
-        ind++;
-        number_to_convert = number_to_convert >> 1;
-    } while(number_to_convert > 1);     // see the comments under the Reverse_bits() function
-    
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define BIT_SWAR_LE 1
+#else
+#define BIT_SWAR_LE 0
+#endif
+
+
+static void binary_byte(char *buf, uint8_t byte){
+    /* Write the 8 bits of byte into buf[0..8), highest bit first */
+#if BIT_SWAR_LE
+    uint64_t w = (byte * 0x0101010101010101ULL) & 0x0102040810204080ULL;
+    w = ((w + 0x7F7F7F7F7F7F7F7FULL) >> 7) & 0x0101010101010101ULL;     // 1 where a bit was kept
+    w += 0x3030303030303030ULL;     // '0' or '1'
+    memcpy(buf, &w, sizeof(w));
+#else
+    for (unsigned i = 0; i < 8; i++){
+        buf[i] = '0' + ((byte >> (7 - i)) & 1);
+    }
+#endif
+}
+
+
+static size_t binary_unterminated(char buf[], uint64_t value, unsigned width){
+    /* Write the low width bits of value (1 <= width <= 64) into buf, highest first */
+    unsigned partial = width % 8;
+    size_t ind = 0;
+
+    for (unsigned bit = width; bit > width - partial; bit--){
+        buf[ind++] = '0' + ((value >> (bit - 1)) & 1);
+    }
+    for (unsigned byte = (width - partial) / 8; byte; byte--){
+        binary_byte(buf + ind, (uint8_t)(value >> ((byte - 1) * 8)));
+        ind += 8;
+    }
+    return ind;
+}
+
+
+static size_t hex_unterminated(char buf[], uint64_t value, unsigned width, bool uppercase){
+    /* Write the low width nibbles of value (1 <= width <= 16) into buf, highest first */
+    const char *digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    for (unsigned i = 0; i < width; i++){
+        buf[i] = digits[(value >> ((width - 1 - i) * 4)) & 0xF];
+    }
+    return width;
+}
+
+
+static unsigned binary_width(uint64_t value, unsigned width){
+    if (width == 0){
+        width = bit_length64(value);
+        return width ? width : 1;   // 0 still gets one digit
+    }
+    return (width > 64) ? 64 : width;
+}
+
+
+static unsigned hex_width(uint64_t value, unsigned width){
+    if (width == 0){
+        width = (bit_length64(value) + 3) / 4;
+        return width ? width : 1;
+    }
+    return (width > 16) ? 16 : width;
 }
 
 
+size_t bit_format_binary(char buf[], uint64_t value, unsigned width){
+    /* Write the lowest width bits of value into buf as '0's and '1's, highest
+       bit first, NUL-terminate it, and return the number of digits.
+       Higher bits are dropped and missing ones come out as leading '0's.
+       A width of 0 means just as many digits as value needs (at least one).
+       buf needs width + 1 chars, and BIT_BINARY_MAX is always enough.
+    */
+    size_t length = binary_unterminated(buf, value, binary_width(value, width));
+    buf[length] = '\0';
+    return length;
+}
+
+
+size_t bit_format_hex(char buf[], uint64_t value, unsigned width, bool uppercase){
+    /* Same as bit_format_binary, in hex digits: width counts nibbles (up to 16),
+       and BIT_HEX_MAX chars are always enough. There's no "0x" prefix.
+    */
+    size_t length = hex_unterminated(buf, value, hex_width(value, width), uppercase);
+    buf[length] = '\0';
+    return length;
+}
 
+
+size_t bit_format_binary_words(char buf[], const uint64_t words[], size_t count, unsigned width, char separator){
+    /* Write count words into buf with bit_format_binary, one after another,
+       with separator between them ('\0' for none), NUL-terminate the
+       result and return its length.
+       Every word gets the same width; 0 means 64 here, so the columns line up.
+       buf needs BIT_BINARY_WORDS_SIZE(count, width) chars, i.e.
+       count * (w + 1) + 1 where w is the width actually used (64 for 0).
+    */
+    width = width ? binary_width(0, width) : 64;
+    size_t position = 0;
+
+    for (size_t i = 0; i < count; i++){
+        if (i > 0 && separator){
+            buf[position++] = separator;
+        }
+        position += binary_unterminated(buf + position, words[i], width);
+    }
+    buf[position] = '\0';
+    return position;
+}
+
+
+size_t bit_format_hex_words(char buf[], const uint64_t words[], size_t count, unsigned width,
+                            bool uppercase, char separator){
+    /* bit_format_binary_words in hex: width counts nibbles and 0 means 16,
+       so buf needs BIT_HEX_WORDS_SIZE(count, width) chars, i.e.
+       count * (w + 1) + 1 where w is the width actually used (16 for 0).
+    */
+    width = width ? hex_width(0, width) : 16;
+    size_t position = 0;
+
+    for (size_t i = 0; i < count; i++){
+        if (i > 0 && separator){
+            buf[position++] = separator;
+        }
+        position += hex_unterminated(buf + position, words[i], width, uppercase);
+    }
+    buf[position] = '\0';
+    return position;
+}
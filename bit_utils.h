@@ -2,6 +2,8 @@
 #define BIT_UTILS_H
 
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 typedef enum signed_or_unsigned{
     SIGNED, UNSIGNED
@@ -13,4 +15,59 @@ uint8_t Count_bits(long long num);
 long long Reverse_bits(long long num);
 
 
+/* Fixed-width bit primitives, for unsigned 8/16/32/64-bit values.
+   popcount counts the set bits; clz/ctz count the 0 bits above the highest
+   or below the lowest set bit (the full width for 0); bit_length is the
+   position of the highest set bit plus one (0 for 0); bit_reverse mirrors
+   all the bits of the type.
+   These use POPCNT/LZCNT/TZCNT where the CPU or the build allows it.
+*/
+unsigned bit_popcount8(uint8_t x);
+unsigned bit_popcount16(uint16_t x);
+unsigned bit_popcount32(uint32_t x);
+unsigned bit_popcount64(uint64_t x);
+
+unsigned bit_clz8(uint8_t x);
+unsigned bit_clz16(uint16_t x);
+unsigned bit_clz32(uint32_t x);
+unsigned bit_clz64(uint64_t x);
+
+unsigned bit_ctz8(uint8_t x);
+unsigned bit_ctz16(uint16_t x);
+unsigned bit_ctz32(uint32_t x);
+unsigned bit_ctz64(uint64_t x);
+
+unsigned bit_length8(uint8_t x);
+unsigned bit_length16(uint16_t x);
+unsigned bit_length32(uint32_t x);
+unsigned bit_length64(uint64_t x);
+
+uint8_t bit_reverse8(uint8_t x);
+uint16_t bit_reverse16(uint16_t x);
+uint32_t bit_reverse32(uint32_t x);
+uint64_t bit_reverse64(uint64_t x);
+
+
+/* Binary and hex formatting, highest digit first and NUL-terminated.
+   width is the number of digits to write (0: as many as the value needs).
+   The _words variants format a whole array with the same width for every
+   word (0: the full 64 bits), optionally separated by separator ('\0' for none).
+   BIT_BINARY_WORDS_SIZE/BIT_HEX_WORDS_SIZE give the buffer size they need
+   for count words at a given width, 0 included.
+*/
+#define BIT_BINARY_MAX 65   // 64 digits and the NUL
+#define BIT_HEX_MAX 17      // 16 digits and the NUL
+
+#define BIT_BINARY_WORDS_SIZE(count, width) \
+    ((count) * ((((width) == 0 || (width) > 64) ? 64 : (width)) + 1) + 1)
+#define BIT_HEX_WORDS_SIZE(count, width) \
+    ((count) * ((((width) == 0 || (width) > 16) ? 16 : (width)) + 1) + 1)
+
+size_t bit_format_binary(char buf[], uint64_t value, unsigned width);
+size_t bit_format_hex(char buf[], uint64_t value, unsigned width, bool uppercase);
+size_t bit_format_binary_words(char buf[], const uint64_t words[], size_t count, unsigned width, char separator);
+size_t bit_format_hex_words(char buf[], const uint64_t words[], size_t count, unsigned width,
+                            bool uppercase, char separator);
+
+
 #endif
@@ -0,0 +1,456 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bit_utils.h"
+#include "cpu_features.h"
+#include "bitset.h"
+
+#if CPU_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+
+
+/*                              * * *
+   KERNELS
+
+   Counting and the set operations run over whole word arrays, so on x86
+   they have AVX2 versions that handle 4 words per step; the one to use is
+   picked before main() by bitset_init_kernels(), like in pstrings.
+
+   The AVX2 count is Harley-Seal: 16 vectors at a time go through a tree
+   of carry-save adders, so only one vector in 16 (the "sixteens") has its
+   bits actually counted, with a nibble lookup (PSHUFB) and PSADBW.
+   The partial sums left in the ones/twos/fours/eights vectors are counted
+   once at the end.
+*/
+
+static uint64_t count_word(const uint64_t *words, size_t num_words){
+    uint64_t count = 0;
+    for (size_t i = 0; i < num_words; i++){
+        count += bit_popcount64(words[i]);
+    }
+    return count;
+}
+
+
+static uint64_t and_count_word(const uint64_t *words1, const uint64_t *words2, size_t num_words){
+    uint64_t count = 0;
+    for (size_t i = 0; i < num_words; i++){
+        count += bit_popcount64(words1[i] & words2[i]);
+    }
+    return count;
+}
+
+
+static void and_word(uint64_t *dst, const uint64_t *src, size_t num_words){
+    for (size_t i = 0; i < num_words; i++){
+        dst[i] &= src[i];
+    }
+}
+
+static void or_word(uint64_t *dst, const uint64_t *src, size_t num_words){
+    for (size_t i = 0; i < num_words; i++){
+        dst[i] |= src[i];
+    }
+}
+
+static void xor_word(uint64_t *dst, const uint64_t *src, size_t num_words){
+    for (size_t i = 0; i < num_words; i++){
+        dst[i] ^= src[i];
+    }
+}
+
+static void andnot_word(uint64_t *dst, const uint64_t *src, size_t num_words){
+    for (size_t i = 0; i < num_words; i++){
+        dst[i] &= ~src[i];
+    }
+}
+
+
+static unsigned select_in_word_word(uint64_t w, unsigned k){
+    /* Return the position of set bit number k (from 0) in w; w has more than k set bits */
+    unsigned position = 0;
+
+    // skip whole bytes while they don't hold the bit we're after
+    for (;;){
+        unsigned in_byte = bit_popcount8((uint8_t)w);
+        if (k < in_byte){
+            break;
+        }
+        k -= in_byte;
+        w >>= 8;
+        position += 8;
+    }
+    for (; k; k--){
+        w &= w - 1;     // drop the lowest set bit
+    }
+    return position + bit_ctz64(w);
+}
+
+
+#if CPU_X86_DISPATCH
+
+#define CSA(high, low, a, b, c) do { \
+        __m256i u_ = _mm256_xor_si256((a), (b)); \
+        (high) = _mm256_or_si256(_mm256_and_si256((a), (b)), _mm256_and_si256(u_, (c))); \
+        (low) = _mm256_xor_si256(u_, (c)); \
+    } while (0)
+
+
+CPU_TARGET("avx2")
+static __m256i count_vector_avx2(__m256i v){
+    /* Bit counts of the four 64-bit lanes of v */
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_nibbles = _mm256_set1_epi8(0x0F);
+    __m256i low = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low_nibbles));
+    __m256i high = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibbles));
+    return _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256());
+}
+
+
+CPU_TARGET("avx2")
+static uint64_t sum_lanes_avx2(__m256i v){
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+
+CPU_TARGET("avx2")
+static inline __m256i load_vector_avx2(const uint64_t *words1, const uint64_t *words2, size_t i){
+    /* Vector i of words1, or of words1 & words2 if words2 isn't NULL */
+    __m256i v = _mm256_loadu_si256((const __m256i *)words1 + i);
+    if (words2){
+        v = _mm256_and_si256(v, _mm256_loadu_si256((const __m256i *)words2 + i));
+    }
+    return v;
+}
+
+
+CPU_TARGET("avx2")
+static uint64_t harley_seal_avx2(const uint64_t *words1, const uint64_t *words2, size_t num_words){
+    /* Count the set bits in words1, or in words1 & words2 if words2 isn't NULL */
+    size_t num_vectors = num_words / 4;
+    __m256i total = _mm256_setzero_si256();
+    __m256i ones = _mm256_setzero_si256(), twos = ones, fours = ones, eights = ones, sixteens;
+    __m256i twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+    __m256i v[16];
+    size_t i = 0;
+
+    for (; i + 16 <= num_vectors; i += 16){
+        for (size_t k = 0; k < 16; k++){
+            v[k] = load_vector_avx2(words1, words2, i + k);
+        }
+        CSA(twos_a, ones, ones, v[0], v[1]);
+        CSA(twos_b, ones, ones, v[2], v[3]);
+        CSA(fours_a, twos, twos, twos_a, twos_b);
+        CSA(twos_a, ones, ones, v[4], v[5]);
+        CSA(twos_b, ones, ones, v[6], v[7]);
+        CSA(fours_b, twos, twos, twos_a, twos_b);
+        CSA(eights_a, fours, fours, fours_a, fours_b);
+        CSA(twos_a, ones, ones, v[8], v[9]);
+        CSA(twos_b, ones, ones, v[10], v[11]);
+        CSA(fours_a, twos, twos, twos_a, twos_b);
+        CSA(twos_a, ones, ones, v[12], v[13]);
+        CSA(twos_b, ones, ones, v[14], v[15]);
+        CSA(fours_b, twos, twos, twos_a, twos_b);
+        CSA(eights_b, fours, fours, fours_a, fours_b);
+        CSA(sixteens, eights, eights, eights_a, eights_b);
+        total = _mm256_add_epi64(total, count_vector_avx2(sixteens));
+    }
+    total = _mm256_slli_epi64(total, 4);
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(count_vector_avx2(eights), 3));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(count_vector_avx2(fours), 2));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(count_vector_avx2(twos), 1));
+    total = _mm256_add_epi64(total, count_vector_avx2(ones));
+    for (; i < num_vectors; i++){
+        total = _mm256_add_epi64(total, count_vector_avx2(load_vector_avx2(words1, words2, i)));
+    }
+    return sum_lanes_avx2(total);
+}
+
+
+CPU_TARGET("avx2")
+static uint64_t count_avx2(const uint64_t *words, size_t num_words){
+    size_t done = num_words / 4 * 4;
+    return harley_seal_avx2(words, NULL, num_words) + count_word(words + done, num_words - done);
+}
+
+
+CPU_TARGET("avx2")
+static uint64_t and_count_avx2(const uint64_t *words1, const uint64_t *words2, size_t num_words){
+    size_t done = num_words / 4 * 4;
+    return harley_seal_avx2(words1, words2, num_words)
+           + and_count_word(words1 + done, words2 + done, num_words - done);
+}
+
+
+#define BITSET_OP_AVX2(name, vector_op, word_fallback) \
+    CPU_TARGET("avx2") \
+    static void name(uint64_t *dst, const uint64_t *src, size_t num_words){ \
+        size_t i = 0; \
+        for (; i + 4 <= num_words; i += 4){ \
+            __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i)); \
+            __m256i s = _mm256_loadu_si256((const __m256i *)(src + i)); \
+            _mm256_storeu_si256((__m256i *)(dst + i), vector_op); \
+        } \
+        word_fallback(dst + i, src + i, num_words - i); \
+    }
+
+BITSET_OP_AVX2(and_avx2, _mm256_and_si256(d, s), and_word)
+BITSET_OP_AVX2(or_avx2, _mm256_or_si256(d, s), or_word)
+BITSET_OP_AVX2(xor_avx2, _mm256_xor_si256(d, s), xor_word)
+BITSET_OP_AVX2(andnot_avx2, _mm256_andnot_si256(s, d), andnot_word)   // ANDNOT negates its first operand
+
+
+#if defined(__x86_64__)
+CPU_TARGET("bmi,bmi2")
+static unsigned select_in_word_bmi2(uint64_t w, unsigned k){
+    // deposit a single 1 onto the k'th set bit of w, then find it
+    return (unsigned)_tzcnt_u64(_pdep_u64((uint64_t)1 << k, w));
+}
+#endif
+
+#endif  // CPU_X86_DISPATCH
+
+
+static uint64_t (*count_kernel)(const uint64_t *, size_t) = count_word;
+static uint64_t (*and_count_kernel)(const uint64_t *, const uint64_t *, size_t) = and_count_word;
+static void (*and_kernel)(uint64_t *, const uint64_t *, size_t) = and_word;
+static void (*or_kernel)(uint64_t *, const uint64_t *, size_t) = or_word;
+static void (*xor_kernel)(uint64_t *, const uint64_t *, size_t) = xor_word;
+static void (*andnot_kernel)(uint64_t *, const uint64_t *, size_t) = andnot_word;
+static unsigned (*select_in_word_kernel)(uint64_t, unsigned) = select_in_word_word;
+
+
+CPU_CONSTRUCTOR
+static void bitset_init_kernels(void){
+#if CPU_X86_DISPATCH
+    if (cpu_simd_level() == SIMD_AVX2){
+        count_kernel = count_avx2;
+        and_count_kernel = and_count_avx2;
+        and_kernel = and_avx2;
+        or_kernel = or_avx2;
+        xor_kernel = xor_avx2;
+        andnot_kernel = andnot_avx2;
+    }
+#if defined(__x86_64__)
+    if (cpu_has_bmi1() && cpu_has_bmi2()){
+        select_in_word_kernel = select_in_word_bmi2;
+    }
+#endif
+#endif
+}
+
+
+
+/*                              * * *
+   BITSET
+*/
+
+#define BLOCK_WORDS (BITSET_BLOCK_BITS / 64)
+
+
+static void free_index(Bitset *bitset){
+    free(bitset->super_ranks);
+    free(bitset->block_ranks);
+    free(bitset->select_samples);
+    bitset->super_ranks = NULL;
+    bitset->block_ranks = NULL;
+    bitset->select_samples = NULL;
+    bitset->num_select_samples = 0;
+    bitset->num_set = 0;
+}
+
+
+bool bitset_init(Bitset *bitset, size_t num_bits){
+    /* Set up bitset to hold num_bits bits, all of them clear.
+       Return false if the memory can't be allocated.
+    */
+    bitset->num_bits = num_bits;
+    bitset->num_words = (num_bits + 63) / 64;
+    bitset->num_blocks = (bitset->num_words + BLOCK_WORDS - 1) / BLOCK_WORDS;
+    bitset->super_ranks = NULL;
+    bitset->block_ranks = NULL;
+    bitset->select_samples = NULL;
+    bitset->num_select_samples = 0;
+    bitset->num_set = 0;
+    // at least one word, so that words is never NULL
+    bitset->words = calloc(bitset->num_words ? bitset->num_words : 1, sizeof(uint64_t));
+    return bitset->words != NULL;
+}
+
+
+void bitset_free(Bitset *bitset){
+    free(bitset->words);
+    bitset->words = NULL;
+    free_index(bitset);
+}
+
+
+void bitset_clear_all(Bitset *bitset){
+    memset(bitset->words, 0, bitset->num_words * sizeof(uint64_t));
+}
+
+
+static size_t common_words(const Bitset *bitset1, const Bitset *bitset2){
+    // if the sizes don't match after all, stay inside the smaller one
+    return (bitset1->num_words < bitset2->num_words) ? bitset1->num_words : bitset2->num_words;
+}
+
+
+void bitset_and(Bitset *dst, const Bitset *src){
+    and_kernel(dst->words, src->words, common_words(dst, src));
+}
+
+void bitset_or(Bitset *dst, const Bitset *src){
+    or_kernel(dst->words, src->words, common_words(dst, src));
+}
+
+void bitset_xor(Bitset *dst, const Bitset *src){
+    xor_kernel(dst->words, src->words, common_words(dst, src));
+}
+
+void bitset_andnot(Bitset *dst, const Bitset *src){
+    andnot_kernel(dst->words, src->words, common_words(dst, src));
+}
+
+
+uint64_t bitset_count(const Bitset *bitset){
+    return count_kernel(bitset->words, bitset->num_words);
+}
+
+
+uint64_t bitset_and_count(const Bitset *bitset1, const Bitset *bitset2){
+    return and_count_kernel(bitset1->words, bitset2->words, common_words(bitset1, bitset2));
+}
+
+
+
+/*                              * * *
+   RANK / SELECT
+
+   The bits are split into 512-bit blocks (8 words, one cache line).
+   super_ranks holds the absolute number of set bits before every run of
+   128 blocks (65536 bits), and block_ranks the count before each block
+   relative to its super block, which always fits in 16 bits. Both arrays
+   have an extra entry at the end for the block past the last one, so
+   rank(num_bits) needs no special case.
+
+   rank(bit) is then two lookups plus the popcount of at most 8 words.
+   select(k) starts from select_samples, which records the block holding
+   every 8192nd set bit, binary-searches the block ranks between that
+   sample and the next one, and finishes with a select inside one word.
+   That's constant time where the bits are reasonably dense and
+   logarithmic in the gap between samples where they aren't.
+*/
+
+static inline uint64_t rank_at_block(const Bitset *bitset, size_t block){
+    return bitset->super_ranks[block / BITSET_SUPER_BLOCKS] + bitset->block_ranks[block];
+}
+
+
+bool bitset_build_index(Bitset *bitset){
+    /* Build (or rebuild) the index used by bitset_rank() and bitset_select().
+       Return false if the memory can't be allocated, in which case
+       there's no index.
+    */
+    size_t num_blocks = bitset->num_blocks;
+    size_t num_supers = num_blocks / BITSET_SUPER_BLOCKS + 1;
+
+    free_index(bitset);
+    bitset->super_ranks = malloc(num_supers * sizeof(uint64_t));
+    bitset->block_ranks = malloc((num_blocks + 1) * sizeof(uint16_t));
+    if (!bitset->super_ranks || !bitset->block_ranks){
+        free_index(bitset);
+        return false;
+    }
+
+    uint64_t running = 0;
+    for (size_t block = 0; block <= num_blocks; block++){
+        if (block % BITSET_SUPER_BLOCKS == 0){
+            bitset->super_ranks[block / BITSET_SUPER_BLOCKS] = running;
+        }
+        bitset->block_ranks[block] = (uint16_t)(running - bitset->super_ranks[block / BITSET_SUPER_BLOCKS]);
+        if (block < num_blocks){
+            size_t first = block * BLOCK_WORDS;
+            size_t words = (bitset->num_words - first < BLOCK_WORDS) ? bitset->num_words - first : BLOCK_WORDS;
+            running += count_word(bitset->words + first, words);
+        }
+    }
+    bitset->num_set = running;
+
+    // one sample per BITSET_SELECT_SAMPLE set bits, plus one for the 0th
+    size_t num_samples = (running + BITSET_SELECT_SAMPLE - 1) / BITSET_SELECT_SAMPLE;
+    bitset->select_samples = malloc((num_samples ? num_samples : 1) * sizeof(size_t));
+    if (!bitset->select_samples){
+        free_index(bitset);
+        return false;
+    }
+    size_t sample = 0;
+    for (size_t block = 0; block < num_blocks && sample < num_samples; block++){
+        // every sample whose set bit falls inside this block points at it
+        while (sample < num_samples && rank_at_block(bitset, block + 1) > (uint64_t)sample * BITSET_SELECT_SAMPLE){
+            bitset->select_samples[sample++] = block;
+        }
+    }
+    bitset->num_select_samples = num_samples;
+    return true;
+}
+
+
+uint64_t bitset_rank(const Bitset *bitset, size_t bit){
+    /* Return the number of set bits before bit, i.e. in [0, bit).
+       bit can be anything up to and including num_bits.
+    */
+    size_t block = bit / BITSET_BLOCK_BITS;
+    size_t word = block * BLOCK_WORDS;
+    size_t last_word = bit / 64;
+    uint64_t rank = rank_at_block(bitset, block);
+
+    for (; word < last_word; word++){
+        rank += bit_popcount64(bitset->words[word]);
+    }
+    if (bit % 64){
+        rank += bit_popcount64(bitset->words[last_word] & (((uint64_t)1 << (bit % 64)) - 1));
+    }
+    return rank;
+}
+
+
+bool bitset_select(const Bitset *bitset, uint64_t k, size_t *bit){
+    /* Store the position of set bit number k (counting from 0) in *bit and
+       return true, or return false if there are no more than k set bits.
+       select is the inverse of rank: bitset_rank(bitset, *bit) == k.
+    */
+    if (k >= bitset->num_set){
+        return false;
+    }
+
+    size_t sample = k / BITSET_SELECT_SAMPLE;
+    size_t low = bitset->select_samples[sample];
+    size_t high = (sample + 1 < bitset->num_select_samples) ? bitset->select_samples[sample + 1]
+                                                           : bitset->num_blocks - 1;
+    // the last block in [low, high] that starts at or before set bit k
+    while (low < high){
+        size_t middle = low + (high - low + 1) / 2;
+        if (rank_at_block(bitset, middle) <= k){
+            low = middle;
+        }
+        else{
+            high = middle - 1;
+        }
+    }
+
+    uint64_t remaining = k - rank_at_block(bitset, low);
+    for (size_t word = low * BLOCK_WORDS;; word++){
+        unsigned count = bit_popcount64(bitset->words[word]);
+        if (remaining < count){
+            *bit = word * 64 + select_in_word_kernel(bitset->words[word], (unsigned)remaining);
+            return true;
+        }
+        remaining -= count;
+    }
+}
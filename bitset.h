@@ -0,0 +1,72 @@
+#ifndef BITSET_H
+#define BITSET_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* A fixed-size set of bits, stored 64 to a word: bit i lives in bit
+   (i % 64) of words[i / 64]. The bits past num_bits in the last word
+   are always 0.
+
+   A Bitset is set up with bitset_init() (all bits clear) and released
+   with bitset_free(). The set operations work in place on dst and expect
+   both bitsets to have the same number of bits.
+
+   bitset_rank() and bitset_select() need the index built by
+   bitset_build_index(), which has to be rebuilt after the bits change.
+   The index costs about 4% of the size of the bits: a running count for
+   every 512-bit block plus the block of every BITSET_SELECT_SAMPLE'th set bit.
+*/
+#define BITSET_BLOCK_BITS 512       // rank is sampled once per block
+#define BITSET_SUPER_BLOCKS 128     // blocks per absolute 64-bit count
+#define BITSET_SELECT_SAMPLE 8192   // set bits between select samples
+
+typedef struct bitset Bitset;
+
+struct bitset{
+    uint64_t *words;
+    size_t num_bits;
+    size_t num_words;
+
+    // rank/select index; NULL until bitset_build_index()
+    uint64_t *super_ranks;      // set bits before each run of BITSET_SUPER_BLOCKS blocks
+    uint16_t *block_ranks;      // set bits before each block, counted from its super block
+    size_t *select_samples;     // block holding set bit number k * BITSET_SELECT_SAMPLE
+    size_t num_blocks;
+    size_t num_select_samples;
+    uint64_t num_set;           // total set bits when the index was built
+};
+
+bool bitset_init(Bitset *bitset, size_t num_bits);
+void bitset_free(Bitset *bitset);
+
+static inline void bitset_set(Bitset *bitset, size_t bit){
+    bitset->words[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+static inline void bitset_clear(Bitset *bitset, size_t bit){
+    bitset->words[bit / 64] &= ~((uint64_t)1 << (bit % 64));
+}
+
+static inline bool bitset_test(const Bitset *bitset, size_t bit){
+    return (bitset->words[bit / 64] >> (bit % 64)) & 1;
+}
+
+void bitset_clear_all(Bitset *bitset);
+
+void bitset_and(Bitset *dst, const Bitset *src);      // dst &= src
+void bitset_or(Bitset *dst, const Bitset *src);       // dst |= src
+void bitset_xor(Bitset *dst, const Bitset *src);      // dst ^= src
+void bitset_andnot(Bitset *dst, const Bitset *src);   // dst &= ~src
+
+uint64_t bitset_count(const Bitset *bitset);                            // number of set bits
+uint64_t bitset_and_count(const Bitset *bitset1, const Bitset *bitset2);  // size of the intersection, without building it
+
+bool bitset_build_index(Bitset *bitset);
+uint64_t bitset_rank(const Bitset *bitset, size_t bit);     // set bits in [0, bit)
+bool bitset_select(const Bitset *bitset, uint64_t k, size_t *bit);  // position of set bit number k, counting from 0
+
+
+#endif
@@ -0,0 +1,207 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "concurrent_queue.h"
+
+
+static size_t round_up_pow2(size_t n){
+    /* The smallest power of two >= n (and >= 2) */
+    size_t res = 2;
+    while (res < n){
+        res <<= 1;
+    }
+    return res;
+}
+
+
+
+/*                              * * *
+   MPMC
+
+   Slot i of a queue with capacity C starts out with sequence i. For the
+   append at position pos (a counter that only grows), the slot is
+   slots[pos & mask], and it's free for that append when its sequence
+   equals pos. The producer writes the value and sets the sequence to
+   pos + 1, which is what the pop at position pos waits for; the consumer
+   then sets it to pos + C, the position of the next append to that slot.
+
+   A sequence below what a thread is looking for means the ring is full
+   (for an append) or empty (for a pop). One above means another thread
+   got to that position first, so the thread reloads the counter and
+   tries again.
+*/
+
+bool CQ_init(ConcurrentQueue *queue, size_t capacity){
+    /* Set up queue to hold capacity chars, rounded up to a power of two.
+       Return false if the memory can't be allocated.
+    */
+    capacity = round_up_pow2(capacity);
+    queue->slots = malloc(capacity * sizeof(ConcurrentQueue_slot));
+    if (!queue->slots){
+        return false;
+    }
+    for (size_t i = 0; i < capacity; i++){
+        atomic_init(&queue->slots[i].sequence, i);
+    }
+    queue->mask = capacity - 1;
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->head, 0);
+    return true;
+}
+
+
+void CQ_destroy(ConcurrentQueue *queue){
+    /* Free the ring. No other thread may be using the queue */
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+
+size_t CQ_get_capacity(const ConcurrentQueue *queue){
+    return queue->mask + 1;
+}
+
+
+size_t CQ_get_num_items(ConcurrentQueue *queue){
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    return (tail > head) ? tail - head : 0;  // the two loads aren't taken at the same instant
+}
+
+
+bool CQ_append(ConcurrentQueue *queue, char val){
+    /* Append val to the queue and return true, or return false if it's full */
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    ConcurrentQueue_slot *slot;
+
+    for (;;){
+        slot = &queue->slots[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0){
+            // the slot is ours if no other producer claims pos first; on failure pos is reloaded
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)){
+                break;
+            }
+        }
+        else if (diff < 0){
+            return false;   // the consumer of the previous lap hasn't freed it yet: full
+        }
+        else{
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+    slot->data = val;
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+    return true;
+}
+
+
+bool CQ_head_pop(ConcurrentQueue *queue, char *val){
+    /* Remove the value at the head of the queue, store it in *val and
+       return true, or return false if the queue is empty.
+    */
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    ConcurrentQueue_slot *slot;
+
+    for (;;){
+        slot = &queue->slots[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (diff == 0){
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)){
+                break;
+            }
+        }
+        else if (diff < 0){
+            return false;   // no producer has filled it yet: empty
+        }
+        else{
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+    *val = slot->data;
+    atomic_store_explicit(&slot->sequence, pos + queue->mask + 1, memory_order_release);
+    return true;
+}
+
+
+
+/*                              * * *
+   SPSC
+
+   head and tail only ever grow, and the number of items is tail - head.
+   The producer is the only writer of tail and the consumer the only writer
+   of head, so each can update its own counter with a plain release store.
+   Each side also keeps a cached copy of the other side's counter and only
+   reloads it (the one access that touches the other side's cache line)
+   when the cached value says it can't proceed.
+*/
+
+bool SPSC_init(SPSCQueue *queue, size_t capacity){
+    /* Set up queue to hold capacity chars, rounded up to a power of two.
+       Return false if the memory can't be allocated.
+    */
+    capacity = round_up_pow2(capacity);
+    queue->data = malloc(capacity);
+    if (!queue->data){
+        return false;
+    }
+    queue->mask = capacity - 1;
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->head, 0);
+    queue->cached_head = 0;
+    queue->cached_tail = 0;
+    return true;
+}
+
+
+void SPSC_destroy(SPSCQueue *queue){
+    free(queue->data);
+    queue->data = NULL;
+}
+
+
+size_t SPSC_get_capacity(const SPSCQueue *queue){
+    return queue->mask + 1;
+}
+
+
+bool SPSC_append(SPSCQueue *queue, char val){
+    /* Append val and return true, or return false if the queue is full.
+       Only the producer thread may call this.
+    */
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    if (tail - queue->cached_head > queue->mask){
+        queue->cached_head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        if (tail - queue->cached_head > queue->mask){
+            return false;
+        }
+    }
+    queue->data[tail & queue->mask] = val;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+
+bool SPSC_head_pop(SPSCQueue *queue, char *val){
+    /* Pop the head into *val and return true, or return false if the queue
+       is empty. Only the consumer thread may call this.
+    */
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    if (head == queue->cached_tail){
+        queue->cached_tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        if (head == queue->cached_tail){
+            return false;
+        }
+    }
+    *val = queue->data[head & queue->mask];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
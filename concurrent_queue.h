@@ -0,0 +1,70 @@
+#ifndef CONCURRENT_QUEUE_H
+#define CONCURRENT_QUEUE_H
+
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Lock-free replacements for using a LinkedList as a work queue between
+ * threads (LL_append() on one side, LL_head_pop() on the other, under a
+ * mutex). Both queues are bounded rings: the capacity is fixed at init
+ * time (rounded up to a power of two), appending to a full queue and
+ * popping an empty one return false instead of blocking, and since no
+ * memory is ever allocated or freed after init, there's nothing to reclaim.
+ *
+ * ConcurrentQueue is multi-producer/multi-consumer: any number of threads
+ * can call CQ_append() and CQ_head_pop() at once. Each slot carries a
+ * sequence number that says whether it's waiting for a producer or a
+ * consumer; a thread claims a position with one CAS on the shared
+ * counter and then hands the slot over by publishing the next sequence
+ * number (Vyukov's bounded MPMC queue).
+ *
+ * SPSCQueue is for exactly one producer thread and one consumer thread.
+ * Each side owns its own counter, so there's no CAS at all: just an
+ * acquire load of the other side's counter, and only when the cached
+ * copy of it says the ring might be full/empty.
+ */
+#define CQ_CACHE_LINE 64
+
+typedef struct concurrent_queue ConcurrentQueue;
+typedef struct concurrent_queue_slot ConcurrentQueue_slot;
+typedef struct spsc_queue SPSCQueue;
+
+struct concurrent_queue_slot{
+atomic_size_t sequence;
+char data;
+};
+
+struct concurrent_queue{
+ConcurrentQueue_slot *slots;
+size_t mask;                                    // capacity - 1
+alignas(CQ_CACHE_LINE) atomic_size_t tail;      // next position to append at
+alignas(CQ_CACHE_LINE) atomic_size_t head;      // next position to pop from
+};
+
+bool CQ_init(ConcurrentQueue *queue, size_t capacity);
+void CQ_destroy(ConcurrentQueue *queue);
+size_t CQ_get_capacity(const ConcurrentQueue *queue);
+size_t CQ_get_num_items(ConcurrentQueue *queue);    // a snapshot, that may be stale by the time it's returned
+bool CQ_append(ConcurrentQueue *queue, char val);
+bool CQ_head_pop(ConcurrentQueue *queue, char *val);
+
+struct spsc_queue{
+char *data;
+size_t mask;
+alignas(CQ_CACHE_LINE) atomic_size_t tail;      // written by the producer only
+size_t cached_head;                             // the producer's last look at head
+alignas(CQ_CACHE_LINE) atomic_size_t head;      // written by the consumer only
+size_t cached_tail;                             // the consumer's last look at tail
+};
+
+bool SPSC_init(SPSCQueue *queue, size_t capacity);
+void SPSC_destroy(SPSCQueue *queue);
+size_t SPSC_get_capacity(const SPSCQueue *queue);
+bool SPSC_append(SPSCQueue *queue, char val);       // producer thread only
+bool SPSC_head_pop(SPSCQueue *queue, char *val);    // consumer thread only
+
+
+#endif
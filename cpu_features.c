@@ -0,0 +1,52 @@
+#include <stdbool.h>
+#include "cpu_features.h"
+
+
+/* All the queries here are cheap, but they're called from constructors that
+   might run before libgcc has filled in its own CPU model, so every query
+   calls __builtin_cpu_init() first (it's idempotent).
+*/
+
+simd_level cpu_simd_level(void){
+    /* Return the widest SIMD level usable on this machine */
+#if CPU_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+        return SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")){
+        return SIMD_SSE2;
+    }
+#endif
+    return SIMD_NONE;
+}
+
+
+bool cpu_has_popcnt(void){
+#if CPU_X86_DISPATCH
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("popcnt");
+#else
+    return false;
+#endif
+}
+
+
+bool cpu_has_bmi1(void){
+#if CPU_X86_DISPATCH
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi");
+#else
+    return false;
+#endif
+}
+
+
+bool cpu_has_bmi2(void){
+#if CPU_X86_DISPATCH
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2");
+#else
+    return false;
+#endif
+}
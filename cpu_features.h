@@ -0,0 +1,49 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+
+#include <stdbool.h>
+
+/* CPU_X86_DISPATCH is 1 when the compiler can build per-function SIMD
+   variants (GCC/Clang targeting x86) that get picked at runtime, and 0 otherwise.
+   Modules wrap their SSE2/AVX2 kernels in #if CPU_X86_DISPATCH and fall
+   back to their portable versions when it's 0.
+*/
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_X86_DISPATCH 1
+#define CPU_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CPU_X86_DISPATCH 0
+#define CPU_TARGET(isa)
+#endif
+
+// run a function before main(), where the compiler supports it
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_CONSTRUCTOR __attribute__((constructor))
+#else
+#define CPU_CONSTRUCTOR
+#endif
+
+/* The scanning kernels deliberately read past the end of a string, up to
+   the end of the aligned block holding its NUL. That can't fault, but
+   AddressSanitizer can't tell it apart from a real overflow.
+*/
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_NO_ASAN __attribute__((no_sanitize_address))
+#else
+#define CPU_NO_ASAN
+#endif
+
+typedef enum cpu_simd_level{
+    SIMD_NONE, SIMD_SSE2, SIMD_AVX2
+} simd_level;
+
+// the widest vector instruction set the running CPU (and OS) supports
+simd_level cpu_simd_level(void);
+
+bool cpu_has_popcnt(void);
+bool cpu_has_bmi1(void);   // tzcnt
+bool cpu_has_bmi2(void);   // pdep/pext
+
+
+#endif
@@ -0,0 +1,265 @@
+#include <string.h>
+#include "instrument.h"
+
+#ifdef CMODULES_INSTRUMENT
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "bit_utils.h"
+#endif
+
+
+/* Every thread that counts something gets a block, allocated the first
+   time and kept on a global list, which is what instr_get_snapshot()
+   walks. A block's counts are only ever changed by its own thread, with
+   a relaxed load and store rather than an atomic add, so that counting
+   costs about what a plain increment does; they're atomic only so that
+   the snapshot can read them while the thread is running. When a thread
+   exits, its counts are folded into the retired block and its own block
+   is freed.
+*/
+
+static const char *const counter_names[INSTR_NUM_COUNTERS] = {
+    "str_from_int allocs", "PString allocs", "StrBuilder allocs",
+    "LL_build_node allocs", "LL pool slabs", "bit_utils calls"
+};
+
+static const char *const histogram_names[INSTR_NUM_HISTOGRAMS] = {
+    "str_len length", "str_hash_n length", "str_find haystack", "str_parse_long chars", "LinkedList length"
+};
+
+
+const char *instr_counter_name(instr_counter counter){
+    return (counter < INSTR_NUM_COUNTERS) ? counter_names[counter] : "";
+}
+
+
+const char *instr_histogram_name(instr_histogram histogram){
+    return (histogram < INSTR_NUM_HISTOGRAMS) ? histogram_names[histogram] : "";
+}
+
+
+uint64_t instr_histogram_percentile(const InstrHistogram *histogram, double percentile){
+    /* The upper end of the bucket the given percentile (0..100) of the
+       values falls in, so at least that many of them are at most this.
+       0 if nothing was recorded.
+    */
+    uint64_t target = (uint64_t)((double)histogram->count * percentile / 100.0);
+    uint64_t seen = 0;
+
+    if (histogram->count == 0){
+        return 0;
+    }
+    for (size_t k = 0; k < INSTR_BUCKETS; k++){
+        seen += histogram->buckets[k];
+        if (seen > 0 && seen >= target){
+            return (k == 0) ? 0 : (k == 64) ? UINT64_MAX : (UINT64_C(1) << k) - 1;
+        }
+    }
+    return UINT64_MAX;
+}
+
+
+
+#ifdef CMODULES_INSTRUMENT
+
+typedef struct instr_block InstrBlock;
+
+struct instr_block{
+    atomic_uint_least64_t counters[INSTR_NUM_COUNTERS];
+    struct{
+        atomic_uint_least64_t count;
+        atomic_uint_least64_t sum;
+        atomic_uint_least64_t buckets[INSTR_BUCKETS];
+    } histograms[INSTR_NUM_HISTOGRAMS];
+    InstrBlock *next;
+    InstrBlock *previous;
+};
+
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+static InstrBlock *blocks = NULL;       // of the running threads
+static InstrBlock retired;              // what the exited threads counted
+static size_t num_threads = 0;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t block_key;
+static _Thread_local InstrBlock *local_block = NULL;
+
+
+static void add_to(atomic_uint_least64_t *value, uint64_t n){
+    // only the owning thread writes, so this doesn't need to be an atomic add
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+
+static void retire_block(void *arg){
+    /* A thread with a block is exiting: keep its counts, drop the block */
+    InstrBlock *block = arg;
+
+    pthread_mutex_lock(&blocks_lock);
+    for (size_t c = 0; c < INSTR_NUM_COUNTERS; c++){
+        add_to(&retired.counters[c], atomic_load_explicit(&block->counters[c], memory_order_relaxed));
+    }
+    for (size_t h = 0; h < INSTR_NUM_HISTOGRAMS; h++){
+        add_to(&retired.histograms[h].count, atomic_load_explicit(&block->histograms[h].count, memory_order_relaxed));
+        add_to(&retired.histograms[h].sum, atomic_load_explicit(&block->histograms[h].sum, memory_order_relaxed));
+        for (size_t k = 0; k < INSTR_BUCKETS; k++){
+            add_to(&retired.histograms[h].buckets[k],
+                   atomic_load_explicit(&block->histograms[h].buckets[k], memory_order_relaxed));
+        }
+    }
+    if (block->previous){
+        block->previous->next = block->next;
+    }
+    else{
+        blocks = block->next;
+    }
+    if (block->next){
+        block->next->previous = block->previous;
+    }
+    pthread_mutex_unlock(&blocks_lock);
+    free(block);
+    // this runs on the exiting thread; whatever it counts in a later destructor
+    // goes into a new block, which the next round of destructors retires
+    local_block = NULL;
+}
+
+
+static void create_key(void){
+    pthread_key_create(&block_key, retire_block);
+}
+
+
+static InstrBlock *get_block(void){
+    /* This thread's block, registering a new one on its first count.
+       NULL if it can't be allocated, in which case nothing is counted.
+    */
+    if (local_block){
+        return local_block;
+    }
+    InstrBlock *block = calloc(1, sizeof(InstrBlock));
+    if (!block){
+        return NULL;
+    }
+    pthread_once(&key_once, create_key);
+    pthread_setspecific(block_key, block);
+
+    pthread_mutex_lock(&blocks_lock);
+    block->next = blocks;
+    block->previous = NULL;
+    if (blocks){
+        blocks->previous = block;
+    }
+    blocks = block;
+    num_threads++;
+    pthread_mutex_unlock(&blocks_lock);
+
+    local_block = block;
+    return block;
+}
+
+
+void instr_count(instr_counter counter, uint64_t n){
+    InstrBlock *block = get_block();
+    if (block){
+        add_to(&block->counters[counter], n);
+    }
+}
+
+
+void instr_record(instr_histogram histogram, uint64_t value){
+    InstrBlock *block = get_block();
+    if (block){
+        add_to(&block->histograms[histogram].count, 1);
+        add_to(&block->histograms[histogram].sum, value);
+        add_to(&block->histograms[histogram].buckets[bit_length64(value)], 1);
+    }
+}
+
+
+bool instr_is_enabled(void){
+    return true;
+}
+
+
+static void add_block(InstrSnapshot *snapshot, InstrBlock *block){
+    for (size_t c = 0; c < INSTR_NUM_COUNTERS; c++){
+        snapshot->counters[c] += atomic_load_explicit(&block->counters[c], memory_order_relaxed);
+    }
+    for (size_t h = 0; h < INSTR_NUM_HISTOGRAMS; h++){
+        InstrHistogram *histogram = &snapshot->histograms[h];
+        histogram->count += atomic_load_explicit(&block->histograms[h].count, memory_order_relaxed);
+        histogram->sum += atomic_load_explicit(&block->histograms[h].sum, memory_order_relaxed);
+        for (size_t k = 0; k < INSTR_BUCKETS; k++){
+            histogram->buckets[k] += atomic_load_explicit(&block->histograms[h].buckets[k], memory_order_relaxed);
+        }
+    }
+}
+
+
+void instr_get_snapshot(InstrSnapshot *snapshot){
+    /* Add up what every thread has counted so far */
+    memset(snapshot, 0, sizeof(InstrSnapshot));
+    pthread_mutex_lock(&blocks_lock);
+    add_block(snapshot, &retired);
+    for (InstrBlock *block = blocks; block; block = block->next){
+        add_block(snapshot, block);
+    }
+    snapshot->num_threads = num_threads;
+    pthread_mutex_unlock(&blocks_lock);
+}
+
+
+static void zero_block(InstrBlock *block){
+    for (size_t c = 0; c < INSTR_NUM_COUNTERS; c++){
+        atomic_store_explicit(&block->counters[c], 0, memory_order_relaxed);
+    }
+    for (size_t h = 0; h < INSTR_NUM_HISTOGRAMS; h++){
+        atomic_store_explicit(&block->histograms[h].count, 0, memory_order_relaxed);
+        atomic_store_explicit(&block->histograms[h].sum, 0, memory_order_relaxed);
+        for (size_t k = 0; k < INSTR_BUCKETS; k++){
+            atomic_store_explicit(&block->histograms[h].buckets[k], 0, memory_order_relaxed);
+        }
+    }
+}
+
+
+void instr_reset(void){
+    pthread_mutex_lock(&blocks_lock);
+    zero_block(&retired);
+    for (InstrBlock *block = blocks; block; block = block->next){
+        zero_block(block);
+    }
+    pthread_mutex_unlock(&blocks_lock);
+}
+
+
+#else
+
+
+void instr_count(instr_counter counter, uint64_t n){
+    (void)counter;
+    (void)n;
+}
+
+
+void instr_record(instr_histogram histogram, uint64_t value){
+    (void)histogram;
+    (void)value;
+}
+
+
+bool instr_is_enabled(void){
+    return false;
+}
+
+
+void instr_get_snapshot(InstrSnapshot *snapshot){
+    memset(snapshot, 0, sizeof(InstrSnapshot));
+}
+
+
+void instr_reset(void){
+}
+
+
+#endif  // CMODULES_INSTRUMENT
@@ -0,0 +1,82 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Counters and histograms on the hot paths of pstrings, bit_utils and
+ * LinkedList, for seeing what a real workload does with them: how many
+ * allocations are made, how long the strings are, how deep the lists get.
+ * That's what pool sizes and SIMD thresholds should be picked from.
+ *
+ * It's all compiled in only when CMODULES_INSTRUMENT is defined (`make
+ * INSTRUMENT=1`, after a `make clean`). Otherwise INSTR_COUNT() and
+ * INSTR_RECORD() expand to nothing, so the instrumented functions are
+ * exactly what they'd be without them; the functions below still exist,
+ * and report all zeros.
+ *
+ * Each thread counts into its own block of counters, so counting never
+ * contends and never takes a lock. instr_get_snapshot() adds up the
+ * blocks of every thread, including the ones that have exited, at the
+ * time it's called. A histogram has a bucket per power of 2: bucket 0
+ * counts the 0s, bucket k the values in [2^(k-1), 2^k).
+ */
+#define INSTR_BUCKETS 65
+
+typedef enum instr_counter{
+    INSTR_STR_FROM_INT_ALLOCS,      // malloc calls by str_from_int
+    INSTR_PSTR_ALLOCS,              // PString buffers allocated or grown
+    INSTR_STR_BUILDER_ALLOCS,       // StrBuilder buffers allocated or grown
+    INSTR_LL_NODE_ALLOCS,           // nodes malloc'ed by LL_build_node
+    INSTR_LL_POOL_SLABS,            // slabs allocated by LinkedList pools
+    INSTR_BIT_CALLS,                // calls to Count_bits, Reverse_bits and get_binary_string
+    INSTR_NUM_COUNTERS
+} instr_counter;
+
+typedef enum instr_histogram{
+    INSTR_STR_LEN,          // the lengths str_len measured
+    INSTR_STR_HASH_LEN,     // key lengths hashed by str_hash_n and str_hash_nocase_n
+    INSTR_STR_FIND_LEN,     // haystack lengths searched for a substring
+    INSTR_STR_PARSE_LEN,    // chars taken up by each number str_parse_long parsed
+    INSTR_LL_LENGTH,        // list lengths after each append, prepend or concat
+    INSTR_NUM_HISTOGRAMS
+} instr_histogram;
+
+typedef struct instr_histogram_data InstrHistogram;
+typedef struct instr_snapshot InstrSnapshot;
+
+struct instr_histogram_data{
+    uint64_t count;     // values recorded
+    uint64_t sum;       // of the values, e.g. the bytes processed
+    uint64_t buckets[INSTR_BUCKETS];
+};
+
+struct instr_snapshot{
+    uint64_t counters[INSTR_NUM_COUNTERS];
+    InstrHistogram histograms[INSTR_NUM_HISTOGRAMS];
+    size_t num_threads;     // that have counted anything
+};
+
+#ifdef CMODULES_INSTRUMENT
+#define INSTR_COUNT(counter, n) instr_count((counter), (n))
+#define INSTR_RECORD(histogram, value) instr_record((histogram), (value))
+#else
+#define INSTR_COUNT(counter, n) ((void)0)
+#define INSTR_RECORD(histogram, value) ((void)0)
+#endif
+
+void instr_count(instr_counter counter, uint64_t n);    // use INSTR_COUNT() rather than calling these directly
+void instr_record(instr_histogram histogram, uint64_t value);
+
+bool instr_is_enabled(void);
+void instr_get_snapshot(InstrSnapshot *snapshot);
+void instr_reset(void);     // zero every thread's counts; not exact while other threads are counting
+
+const char *instr_counter_name(instr_counter counter);
+const char *instr_histogram_name(instr_histogram histogram);
+uint64_t instr_histogram_percentile(const InstrHistogram *histogram, double percentile);    // an upper bound, from the buckets
+
+
+#endif
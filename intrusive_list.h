@@ -0,0 +1,189 @@
+#ifndef INTRUSIVE_LIST_H
+#define INTRUSIVE_LIST_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* An intrusive doubly linked list: instead of the list allocating a node
+ * for each value, the caller embeds an IL_link in its own struct and the
+ * list links those together. Nothing is ever allocated, and since a link
+ * knows its neighbours, any element can be unlinked, moved or used as an
+ * insertion point in O(1) without walking the list. For example, an LRU:
+ *
+ *     struct entry{
+ *         int key;
+ *         IL_link lru;
+ *     };
+ *
+ *     IntrusiveList lru_list;
+ *     IL_init(&lru_list);
+ *     IL_prepend(&lru_list, &entry->lru);         // new entry
+ *     IL_move_to_front(&lru_list, &entry->lru);   // entry was used
+ *     IL_link *oldest = IL_tail_pop(&lru_list);   // evict
+ *     struct entry *victim = IL_container_of(oldest, struct entry, lru);
+ *
+ * The list is circular around a sentinel (root) link that lives in the
+ * IntrusiveList, so none of the operations have to special-case the ends.
+ * A link that isn't in a list has NULL pointers (see IL_link_init()); a
+ * link can only be in one list at a time, but a struct can embed several
+ * links to be in several lists at once.
+ * The list doesn't own its elements: IL_init()ing it or letting it go out
+ * of scope doesn't free anything.
+ */
+
+typedef struct intrusive_link IL_link;
+typedef struct intrusive_list IntrusiveList;
+
+struct intrusive_link{
+IL_link *previous;
+IL_link *next;
+};
+
+struct intrusive_list{
+IL_link root;   // root.next is the head, root.previous the tail
+};
+
+// get the struct of type type that has the IL_link ptr as its member member
+#define IL_container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+
+static inline void IL_init(IntrusiveList *list){
+    list->root.previous = &list->root;
+    list->root.next = &list->root;
+}
+
+static inline void IL_link_init(IL_link *link){
+    link->previous = NULL;
+    link->next = NULL;
+}
+
+static inline bool IL_is_empty(const IntrusiveList *list){
+    return list->root.next == &list->root;
+}
+
+static inline bool IL_is_linked(const IL_link *link){
+    return link->next != NULL;
+}
+
+static inline IL_link *IL_head(IntrusiveList *list){
+    return IL_is_empty(list) ? NULL : list->root.next;
+}
+
+static inline IL_link *IL_tail(IntrusiveList *list){
+    return IL_is_empty(list) ? NULL : list->root.previous;
+}
+
+static inline IL_link *IL_next(IntrusiveList *list, IL_link *link){
+    /* The link after link, or NULL if link is the tail */
+    return (link->next == &list->root) ? NULL : link->next;
+}
+
+static inline IL_link *IL_previous(IntrusiveList *list, IL_link *link){
+    return (link->previous == &list->root) ? NULL : link->previous;
+}
+
+
+static inline void IL_link_between(IL_link *link, IL_link *previous, IL_link *next){
+    link->previous = previous;
+    link->next = next;
+    previous->next = link;
+    next->previous = link;
+}
+
+static inline void IL_insert_after(IL_link *position, IL_link *link){
+    /* Insert the unlinked link right after position, which is in a list */
+    IL_link_between(link, position, position->next);
+}
+
+static inline void IL_insert_before(IL_link *position, IL_link *link){
+    IL_link_between(link, position->previous, position);
+}
+
+static inline void IL_prepend(IntrusiveList *list, IL_link *link){
+    IL_insert_after(&list->root, link);
+}
+
+static inline void IL_append(IntrusiveList *list, IL_link *link){
+    IL_insert_before(&list->root, link);
+}
+
+
+static inline void IL_unlink(IL_link *link){
+    /* Take link out of whatever list it's in. It's left unlinked, so it can
+       be inserted again, or freed by its owner.
+    */
+    link->previous->next = link->next;
+    link->next->previous = link->previous;
+    IL_link_init(link);
+}
+
+static inline IL_link *IL_head_pop(IntrusiveList *list){
+    /* Unlink and return the head, or return NULL if the list is empty */
+    IL_link *head = IL_head(list);
+    if (head){
+        IL_unlink(head);
+    }
+    return head;
+}
+
+static inline IL_link *IL_tail_pop(IntrusiveList *list){
+    IL_link *tail = IL_tail(list);
+    if (tail){
+        IL_unlink(tail);
+    }
+    return tail;
+}
+
+
+static inline void IL_move_to_front(IntrusiveList *list, IL_link *link){
+    /* Make link, which has to be in list, its head */
+    if (list->root.next == link){
+        return;
+    }
+    link->previous->next = link->next;
+    link->next->previous = link->previous;
+    IL_link_between(link, &list->root, list->root.next);
+}
+
+static inline void IL_move_to_back(IntrusiveList *list, IL_link *link){
+    if (list->root.previous == link){
+        return;
+    }
+    link->previous->next = link->next;
+    link->next->previous = link->previous;
+    IL_link_between(link, list->root.previous, &list->root);
+}
+
+
+static inline void IL_splice_range_after(IL_link *position, IL_link *first, IL_link *last){
+    /* Move the run of links first..last (inclusive, in list order, and all
+       in the same list) so that it follows position, which can be in the
+       same list or another one but mustn't be inside the run itself.
+    */
+    // close the gap the run leaves behind
+    first->previous->next = last->next;
+    last->next->previous = first->previous;
+    // and open one after position
+    last->next = position->next;
+    position->next->previous = last;
+    first->previous = position;
+    position->next = first;
+}
+
+static inline void IL_splice_after(IL_link *position, IntrusiveList *src){
+    /* Move all of src's links, in order, to follow position, leaving src empty.
+       position mustn't be in src.
+    */
+    if (!IL_is_empty(src)){
+        IL_splice_range_after(position, src->root.next, src->root.previous);
+    }
+}
+
+static inline void IL_concat(IntrusiveList *dst, IntrusiveList *src){
+    /* Move all of src's links to the end of dst */
+    IL_splice_after(dst->root.previous, src);
+}
+
+
+#endif
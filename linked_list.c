@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include "stdlib.h"
 
+#include "instrument.h"
 #include "linked_list.h"
 
 unsigned int LL_get_num_items(LinkedList *target_linked_list){
@@ -18,12 +19,19 @@ void LL_init(LinkedList *target_linked_list){
     target_linked_list->number_of_items = 0;
     target_linked_list->head_ptr = NULL;
     target_linked_list->tail_ptr = NULL;
+    target_linked_list->pool = NULL;
+}
+
+void LL_init_with_pool(LinkedList *target_linked_list, LinkedList_pool *pool){
+    /* Initialize target_linked_list so that its nodes come from pool */
+    LL_init(target_linked_list);
+    target_linked_list->pool = pool;
 }
 
 bool LL_is_empty(LinkedList *target_linked_list){
     /* Return True if the list is empty and False otherwise  */
     bool res;
-    res = (target_linked_list->number_of_items) ?  true : false;
+    res = (target_linked_list->number_of_items) ?  false : true;
     return res;
 }
 
@@ -32,6 +40,7 @@ LinkedList_node *LL_build_node(void){
     /* Malloc'ates memory for a LinkedList_node and returns a pointer to it */
     LinkedList_node *node;
     void *temp = malloc(sizeof(LinkedList_node));
+    INSTR_COUNT(INSTR_LL_NODE_ALLOCS, 1);
     assert(temp != NULL);   // raise an error if temp is null;
     node = temp; 
     node->previous = NULL;
@@ -39,9 +48,39 @@ LinkedList_node *LL_build_node(void){
     return node;
 }
 
+
+static LinkedList_node *LL_pool_take(LinkedList_pool *pool);
+static LinkedList_node *LL_pool_take_chain(LinkedList_pool *pool, size_t number_of_nodes);
+static void LL_pool_give(LinkedList_pool *pool, LinkedList_node *node);
+static void LL_pool_give_chain(LinkedList_pool *pool, LinkedList_node *first, LinkedList_node *last, size_t number_of_nodes);
+
+
+static LinkedList_node *LL_get_node(LinkedList *target_linked_list){
+    /* Get a fresh node for target_linked_list, from its pool if it has one */
+    if (!target_linked_list->pool){
+        return LL_build_node();
+    }
+    LinkedList_node *node = LL_pool_take(target_linked_list->pool);
+    node->previous = NULL;
+    node->next = NULL;
+    return node;
+}
+
+
+static void LL_release_node(LinkedList *target_linked_list, LinkedList_node *node){
+    /* Give node back to wherever LL_get_node() got it from */
+    if (target_linked_list->pool){
+        LL_pool_give(target_linked_list->pool, node);
+    }
+    else{
+        LL_destroy_node(node);
+    }
+}
+
+
 void LL_append(LinkedList *target_linked_list, char val){
     /* Append val to the list, i.e. make it the new tail  */
-    LinkedList_node *node = LL_build_node();    // build a new node;
+    LinkedList_node *node = LL_get_node(target_linked_list);    // build a new node;
 
     if (target_linked_list->number_of_items > 0){   // if the list isn't empty
         target_linked_list->tail_ptr->next = node;  // make the current tail point to the soon-to-be new tail
@@ -56,13 +95,14 @@ void LL_append(LinkedList *target_linked_list, char val){
         target_linked_list->number_of_items++;
         target_linked_list->tail_ptr->data = val;
     }
+    INSTR_RECORD(INSTR_LL_LENGTH, target_linked_list->number_of_items);
 }
 
 
 void LL_prepend(LinkedList *target_linked_list, char val){
     /* Prepend val to the list, i.e. make it the new head */
     assert(target_linked_list->number_of_items > 0);    // can't prepend if there are no items - raise an exception if attempted;
-    LinkedList_node *node = LL_build_node();    // build a new node;
+    LinkedList_node *node = LL_get_node(target_linked_list);    // build a new node;
     if (target_linked_list->number_of_items > 0){   // if the list isn't empty
         target_linked_list->head_ptr->previous = node;  // make the current head point to the soon-to-be new head 
         node->next= target_linked_list->head_ptr;  // make node's next pointer point to the current tail;
@@ -70,23 +110,27 @@ void LL_prepend(LinkedList *target_linked_list, char val){
         target_linked_list->head_ptr->data = val;
         target_linked_list->number_of_items++;
     }
+    INSTR_RECORD(INSTR_LL_LENGTH, target_linked_list->number_of_items);
 }
 
 
 
 void LL_destroy(LinkedList *target_linked_list){
-    /* Sets all the next and prev pointers to null so that the soace can
-       be automatically reclaimed */
+    /* Free all the nodes in the list and leave it empty.
+       A pooled list hands its whole chain of nodes back to the pool in one go.
+    */
+    if (target_linked_list->pool && target_linked_list->number_of_items > 0){
+        LL_pool_give_chain(target_linked_list->pool, target_linked_list->head_ptr,
+                           target_linked_list->tail_ptr, target_linked_list->number_of_items);
+        target_linked_list->number_of_items = 0;
+    }
     LinkedList_node *current_ptr = target_linked_list->head_ptr; 
-    LinkedList_node *last_node_standing = target_linked_list->tail_ptr;
-    while(target_linked_list->number_of_items != 1){    // one node will be left standing after the loop -- the tail -- 
-                                                        // since thre's no node that has a 'prev' pointing to it
-        current_ptr = current_ptr->next;    // keep destroying the object pointed to by 'previous'
-        LL_destroy_node(current_ptr->previous);
+    while(target_linked_list->number_of_items != 0){
+        LinkedList_node *next_ptr = current_ptr->next;  // read it before the node is gone
+        LL_destroy_node(current_ptr);
+        current_ptr = next_ptr;
         target_linked_list->number_of_items--;
     }
-    LL_destroy_node(last_node_standing);
-    target_linked_list->number_of_items--;
     target_linked_list->head_ptr = NULL;
     target_linked_list->tail_ptr=NULL;
 }
@@ -105,8 +149,13 @@ char LL_head_pop(LinkedList *target_linked_list){
     char val = target_linked_list->head_ptr->data; 
     LinkedList_node *former_head = target_linked_list->head_ptr;
     target_linked_list->head_ptr = target_linked_list->head_ptr->next;
-    target_linked_list->head_ptr->previous = NULL;
-    LL_destroy_node(former_head);
+    if (target_linked_list->head_ptr){
+        target_linked_list->head_ptr->previous = NULL;
+    }
+    else{   // that was the last item
+        target_linked_list->tail_ptr = NULL;
+    }
+    LL_release_node(target_linked_list, former_head);
     target_linked_list->number_of_items--;
 
     return val;
@@ -118,8 +167,13 @@ char LL_tail_pop(LinkedList *target_linked_list){
     char val = target_linked_list->tail_ptr->data; 
     LinkedList_node *former_tail = target_linked_list->tail_ptr;
     target_linked_list->tail_ptr = target_linked_list->tail_ptr->previous;
-    target_linked_list->tail_ptr->next= NULL;
-    LL_destroy_node(former_tail);
+    if (target_linked_list->tail_ptr){
+        target_linked_list->tail_ptr->next= NULL;
+    }
+    else{   // that was the last item
+        target_linked_list->head_ptr = NULL;
+    }
+    LL_release_node(target_linked_list, former_tail);
     target_linked_list->number_of_items--;
 
     return val;
@@ -127,5 +181,304 @@ char LL_tail_pop(LinkedList *target_linked_list){
 
 
 
+/*                              * * *
+   BULK OPERATIONS
+
+   A bulk insert builds the new nodes as a separate chain, fully linked
+   in both directions, and then attaches the whole chain to the list with
+   a couple of pointer updates. A drain walks the nodes it copies out and
+   then detaches them from the list the same way.
+*/
 
+static LinkedList_node *LL_build_chain(LinkedList *target_linked_list, const char vals[], size_t num_vals,
+                                       LinkedList_node **last){
+    /* Build a chain of num_vals nodes holding vals, in order, and return its
+       first node; *last gets its last one. num_vals must be at least 1.
+    */
+    LinkedList_node *first;
+    LinkedList_node *node;
+
+    if (target_linked_list->pool){
+        first = LL_pool_take_chain(target_linked_list->pool, num_vals);     // already chained through ->next
+    }
+    else{
+        first = LL_build_node();
+        node = first;
+        for (size_t i = 1; i < num_vals; i++){
+            node->next = LL_build_node();
+            node = node->next;
+        }
+    }
 
+    LinkedList_node *previous = NULL;
+    node = first;
+    for (size_t i = 0; i < num_vals; i++){
+        node->data = vals[i];
+        node->previous = previous;
+        previous = node;
+        node = node->next;
+    }
+    *last = previous;
+    (*last)->next = NULL;
+    return first;
+}
+
+
+void LL_append_array(LinkedList *target_linked_list, const char vals[], size_t num_vals){
+    /* Append vals[0], vals[1] .. vals[num_vals - 1], so that the last one is the new tail */
+    LinkedList_node *first, *last;
+
+    if (num_vals == 0){
+        return;
+    }
+    first = LL_build_chain(target_linked_list, vals, num_vals, &last);
+    if (target_linked_list->number_of_items > 0){
+        target_linked_list->tail_ptr->next = first;
+        first->previous = target_linked_list->tail_ptr;
+    }
+    else{
+        target_linked_list->head_ptr = first;
+    }
+    target_linked_list->tail_ptr = last;
+    target_linked_list->number_of_items += num_vals;
+    INSTR_RECORD(INSTR_LL_LENGTH, target_linked_list->number_of_items);
+}
+
+
+void LL_prepend_array(LinkedList *target_linked_list, const char vals[], size_t num_vals){
+    /* Insert vals in front of the head, keeping their order: vals[0] is the new head.
+       Unlike LL_prepend(), this works on an empty list too.
+    */
+    LinkedList_node *first, *last;
+
+    if (num_vals == 0){
+        return;
+    }
+    first = LL_build_chain(target_linked_list, vals, num_vals, &last);
+    if (target_linked_list->number_of_items > 0){
+        target_linked_list->head_ptr->previous = last;
+        last->next = target_linked_list->head_ptr;
+    }
+    else{
+        target_linked_list->tail_ptr = last;
+    }
+    target_linked_list->head_ptr = first;
+    target_linked_list->number_of_items += num_vals;
+    INSTR_RECORD(INSTR_LL_LENGTH, target_linked_list->number_of_items);
+}
+
+
+size_t LL_drain_to_array(LinkedList *target_linked_list, char vals[], size_t max_items){
+    /* Pop up to max_items values from the head into vals, in order, and
+       return how many were popped.
+    */
+    size_t count = (target_linked_list->number_of_items < max_items) ? target_linked_list->number_of_items : max_items;
+    LinkedList_node *first = target_linked_list->head_ptr;
+    LinkedList_node *last = NULL;
+    LinkedList_node *node = first;
+
+    if (count == 0){
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++){
+        vals[i] = node->data;
+        last = node;
+        node = node->next;
+    }
+
+    // node is now the first one that stays, if any
+    target_linked_list->head_ptr = node;
+    if (node){
+        node->previous = NULL;
+    }
+    else{
+        target_linked_list->tail_ptr = NULL;
+    }
+    target_linked_list->number_of_items -= count;
+
+    if (target_linked_list->pool){
+        LL_pool_give_chain(target_linked_list->pool, first, last, count);
+    }
+    else{
+        node = first;
+        for (size_t i = 0; i < count; i++){
+            LinkedList_node *next = node->next;
+            LL_destroy_node(node);
+            node = next;
+        }
+    }
+    return count;
+}
+
+
+void LL_concat(LinkedList *dst, LinkedList *src){
+    /* Move all of src's nodes to the end of dst, leaving src empty */
+    assert(dst->pool == src->pool);     // each node has to go back to where it came from
+
+    if (src->number_of_items == 0){
+        return;
+    }
+    if (dst->number_of_items > 0){
+        dst->tail_ptr->next = src->head_ptr;
+        src->head_ptr->previous = dst->tail_ptr;
+    }
+    else{
+        dst->head_ptr = src->head_ptr;
+    }
+    dst->tail_ptr = src->tail_ptr;
+    dst->number_of_items += src->number_of_items;
+    INSTR_RECORD(INSTR_LL_LENGTH, dst->number_of_items);
+
+    src->head_ptr = NULL;
+    src->tail_ptr = NULL;
+    src->number_of_items = 0;
+}
+
+
+void LL_cursor_init(LinkedList_cursor *cursor, const LinkedList *target_linked_list){
+    cursor->node = target_linked_list->head_ptr;
+}
+
+
+bool LL_cursor_next(LinkedList_cursor *cursor, char *val){
+    /* Store the next value in *val and return true, or return false at the end of the list */
+    if (!cursor->node){
+        return false;
+    }
+    *val = cursor->node->data;
+    cursor->node = cursor->node->next;
+    return true;
+}
+
+
+
+/*                              * * *
+   NODE POOL
+
+   Nodes are carved out of slabs of nodes_per_slab at a time. A node that
+   isn't in use sits on the pool's free list, linked through its next
+   pointer, so taking and returning a node are a couple of pointer moves.
+   Slabs are never given back individually: they're only freed all
+   together by LL_pool_destroy(), which is O(number of slabs).
+*/
+
+void LL_pool_init(LinkedList_pool *pool, size_t nodes_per_slab){
+    /* Initialize an empty pool. Nothing is allocated until the first node is needed */
+    pool->free_list = NULL;
+    pool->slabs = NULL;
+    pool->nodes_per_slab = nodes_per_slab ? nodes_per_slab : LL_POOL_DEFAULT_SLAB;
+    pool->number_of_slabs = 0;
+    pool->number_of_nodes = 0;
+    pool->live_nodes = 0;
+    pool->high_water = 0;
+    pool->arena = NULL;
+}
+
+
+void LL_pool_init_with_arena(LinkedList_pool *pool, size_t nodes_per_slab, Arena *arena){
+    /* Initialize an empty pool whose slabs are allocated from arena */
+    LL_pool_init(pool, nodes_per_slab);
+    pool->arena = arena;
+}
+
+
+void LL_pool_destroy(LinkedList_pool *pool){
+    /* Free every slab the pool has allocated. Any list still using the
+       pool is left pointing at freed memory, and has to be LL_init()ed again.
+       The slabs of an arena pool belong to the arena, so they're only
+       forgotten here, to be reclaimed along with the rest of the arena.
+    */
+    LinkedList_slab *slab = pool->slabs;
+    Arena *arena = pool->arena;
+    while (slab && !arena){
+        LinkedList_slab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    LL_pool_init_with_arena(pool, pool->nodes_per_slab, arena);
+}
+
+
+static void LL_pool_grow(LinkedList_pool *pool, size_t number_of_nodes){
+    /* Allocate a new slab of number_of_nodes nodes and put them all on the free list */
+    size_t size = sizeof(LinkedList_slab) + number_of_nodes * sizeof(LinkedList_node);
+    LinkedList_slab *slab = pool->arena ? arena_alloc_aligned(pool->arena, size, alignof(LinkedList_slab))
+                                        : malloc(size);
+    assert(slab != NULL);   // same as LL_build_node: running out of memory is fatal
+    INSTR_COUNT(INSTR_LL_POOL_SLABS, 1);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->number_of_slabs++;
+    pool->number_of_nodes += number_of_nodes;
+
+    // chain them back to front, so the free list hands them out in address order
+    for (size_t i = number_of_nodes; i > 0; i--){
+        slab->nodes[i - 1].next = pool->free_list;
+        pool->free_list = &slab->nodes[i - 1];
+    }
+}
+
+
+static LinkedList_node *LL_pool_take(LinkedList_pool *pool){
+    if (!pool->free_list){
+        LL_pool_grow(pool, pool->nodes_per_slab);
+    }
+    LinkedList_node *node = pool->free_list;
+    pool->free_list = node->next;
+    pool->live_nodes++;
+    if (pool->live_nodes > pool->high_water){
+        pool->high_water = pool->live_nodes;
+    }
+    return node;
+}
+
+
+static LinkedList_node *LL_pool_take_chain(LinkedList_pool *pool, size_t number_of_nodes){
+    /* Take number_of_nodes nodes off the free list, still chained through
+       ->next, growing the pool by one slab first if there aren't enough.
+    */
+    size_t free_nodes = pool->number_of_nodes - pool->live_nodes;
+    if (free_nodes < number_of_nodes){
+        size_t missing = number_of_nodes - free_nodes;
+        LL_pool_grow(pool, (missing > pool->nodes_per_slab) ? missing : pool->nodes_per_slab);
+    }
+
+    LinkedList_node *first = pool->free_list;
+    LinkedList_node *last = first;
+    for (size_t i = 1; i < number_of_nodes; i++){
+        last = last->next;
+    }
+    pool->free_list = last->next;
+    last->next = NULL;
+    pool->live_nodes += number_of_nodes;
+    if (pool->live_nodes > pool->high_water){
+        pool->high_water = pool->live_nodes;
+    }
+    return first;
+}
+
+
+static void LL_pool_give(LinkedList_pool *pool, LinkedList_node *node){
+    node->next = pool->free_list;
+    pool->free_list = node;
+    pool->live_nodes--;
+}
+
+
+static void LL_pool_give_chain(LinkedList_pool *pool, LinkedList_node *first, LinkedList_node *last, size_t number_of_nodes){
+    /* Put the nodes first..last, chained through ->next, back on the free list */
+    last->next = pool->free_list;
+    pool->free_list = first;
+    pool->live_nodes -= number_of_nodes;
+}
+
+
+void LL_pool_get_stats(const LinkedList_pool *pool, LinkedList_pool_stats *stats){
+    /* Fill in stats with the pool's current numbers */
+    stats->number_of_slabs = pool->number_of_slabs;
+    stats->live_nodes = pool->live_nodes;
+    stats->free_nodes = pool->number_of_nodes - pool->live_nodes;
+    stats->high_water = pool->high_water;
+    stats->bytes_allocated = pool->number_of_slabs * sizeof(LinkedList_slab)
+                             + pool->number_of_nodes * sizeof(LinkedList_node);
+}
@@ -1,12 +1,22 @@
+#ifndef LINKED_LIST_H
+#define LINKED_LIST_H
+
+
 #include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
 
 typedef struct linked_list LinkedList;
 typedef struct linked_list_node LinkedList_node;
+typedef struct linked_list_pool LinkedList_pool;
+typedef struct linked_list_slab LinkedList_slab;
+typedef struct linked_list_pool_stats LinkedList_pool_stats;
 
 struct linked_list{
 LinkedList_node * head_ptr;
 LinkedList_node * tail_ptr;
 unsigned int number_of_items;
+LinkedList_pool *pool;      // where the nodes come from; NULL for malloc
 };
 
 struct linked_list_node{
@@ -27,3 +37,96 @@ char LL_head_pop(LinkedList *target_linked_list);
 char LL_tail_pop(LinkedList *target_linked_list);
 void LL_destroy(LinkedList *tail_ptr);
 
+
+/* ----- NODE POOL -----
+ * A LinkedList set up with LL_init_with_pool() takes its nodes from the
+ * pool instead of calling malloc for each one. The pool allocates nodes
+ * nodes_per_slab at a time, and popped or destroyed nodes go back on its
+ * free list to be reused, so LL_destroy() on a pooled list is O(1).
+ * Any number of lists can share a pool; LL_pool_destroy() frees every
+ * slab at once, so it must only be called once none of those lists
+ * are in use anymore. A pool is not thread-safe.
+ *
+ * A pool set up with LL_pool_init_with_arena() carves its slabs out of an
+ * Arena instead of malloc'ing them. Then none of it has to be freed piece
+ * by piece: resetting or freeing the arena drops the slabs, and with them
+ * every node of every list using the pool (which have to be LL_init()ed
+ * again, and the pool LL_pool_init_with_arena()ed again, after that).
+ */
+#define LL_POOL_DEFAULT_SLAB 256    // nodes per slab if 0 is passed to LL_pool_init
+
+struct linked_list_slab{
+LinkedList_slab *next;
+LinkedList_node nodes[];
+};
+
+struct linked_list_pool{
+LinkedList_node *free_list;     // chained through ->next
+LinkedList_slab *slabs;
+size_t nodes_per_slab;
+size_t number_of_slabs;
+size_t number_of_nodes;         // in all the slabs together
+size_t live_nodes;              // handed out and not yet returned
+size_t high_water;              // the most live_nodes has ever been
+Arena *arena;                   // where the slabs come from; NULL for malloc
+};
+
+struct linked_list_pool_stats{
+size_t number_of_slabs;
+size_t live_nodes;
+size_t free_nodes;
+size_t high_water;
+size_t bytes_allocated;
+};
+
+void LL_pool_init(LinkedList_pool *pool, size_t nodes_per_slab);
+void LL_pool_init_with_arena(LinkedList_pool *pool, size_t nodes_per_slab, Arena *arena);
+void LL_pool_destroy(LinkedList_pool *pool);
+void LL_pool_get_stats(const LinkedList_pool *pool, LinkedList_pool_stats *stats);
+void LL_init_with_pool(LinkedList *target_linked_list, LinkedList_pool *pool);
+
+
+/* ----- BULK OPERATIONS -----
+ * LL_append_array()/LL_prepend_array() add a whole buffer, in order, at one
+ * end of the list; LL_drain_to_array() pops up to max_items from the head
+ * into a buffer and returns how many it popped. On a pooled list the nodes
+ * for a bulk insert are taken from the pool in one go (growing it by a
+ * single slab if needed) and the drained nodes are handed back in one
+ * go; without a pool they're malloc'ed and freed one by one, since they
+ * have to be freeable individually.
+ * LL_concat() moves all of src's nodes to the end of dst in O(1); both
+ * lists must use the same pool (or neither).
+ */
+void LL_append_array(LinkedList *target_linked_list, const char vals[], size_t num_vals);
+void LL_prepend_array(LinkedList *target_linked_list, const char vals[], size_t num_vals);
+size_t LL_drain_to_array(LinkedList *target_linked_list, char vals[], size_t max_items);
+void LL_concat(LinkedList *dst, LinkedList *src);
+
+
+/* ----- CURSOR -----
+ * Read-only traversal, head to tail:
+ *
+ *     LinkedList_cursor cursor;
+ *     char val;
+ *     LL_cursor_init(&cursor, &list);
+ *     while (LL_cursor_next(&cursor, &val)){
+ *         ...
+ *     }
+ *
+ * or, with the nodes themselves, LL_foreach(node, &list){ node->data ... }.
+ * The list mustn't be changed while a cursor is walking it.
+ */
+typedef struct linked_list_cursor LinkedList_cursor;
+
+struct linked_list_cursor{
+const LinkedList_node *node;    // the next one to visit
+};
+
+#define LL_foreach(node, list) \
+    for (const LinkedList_node *node = (list)->head_ptr; node; node = node->next)
+
+void LL_cursor_init(LinkedList_cursor *cursor, const LinkedList *target_linked_list);
+bool LL_cursor_next(LinkedList_cursor *cursor, char *val);
+
+
+#endif
@@ -1,293 +1,2896 @@
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
+#include "bit_utils.h"
+#include "cpu_features.h"
+#include "instrument.h"
 #include "pstrings.h"
 
+#if CPU_X86_DISPATCH
+#include <immintrin.h>
+#endif
 
-unsigned int str_len(char string_arg[]){
-/* Find and return the length of string_arg. 
 
-   A string ends when Nul is encountered, i.e.
-   all strings are Nul-terminated. If a char array
-   is not Nul terminated, then it's not a string,
-   and the length can't be determined correctly.
+
+/*                              * * *
+   SCANNING KERNELS
+
+   str_len, str_copy and str_compare sit on every hot path, so each of them
+   has a word-at-a-time version and, on x86, an SSE2 and an AVX2 version that
+   look at 16/32 bytes per step. The fastest one the CPU supports is picked
+   once, before main() runs, by str_init_kernels().
+
+   The NUL terminator can be anywhere, so the kernels only ever load from
+   addresses aligned to the width of the load. An aligned load can't straddle
+   a page boundary, which means reading past the NUL can never fault.
+   str_compare walks two strings that are usually aligned differently; it
+   aligns the loads on str1 and falls back to a byte loop for the one block
+   per page where an unaligned load from str2 would cross into the next page.
+
+   The reversal kernels know the length up front, so they never read past
+   it. They reverse a word or vector at a time from both ends: bswap for
+   words, a byte shuffle for vectors. The same goes for the case kernels,
+   which find the letters in a block with two compares (one unsigned
+   compare per byte in SWAR) and flip their 0x20 bit.
 */
-    unsigned int ind = 0, count = 0;
 
-    while(string_arg[ind] != '\0'){
-        ind++;
-        count++;
+#define ONES_64  0x0101010101010101ULL
+#define HIGHS_64 0x8080808080808080ULL
+// nonzero if any of the 8 bytes in w is 0
+#define WORD_HAS_ZERO(w) (((w) - ONES_64) & ~(w) & HIGHS_64)
+#define LOWS_64  0x7F7F7F7F7F7F7F7FULL
+#define PAGE_SIZE_MIN 4096
+
+// for helpers taking a constant flag, so that each caller gets its own copy with the flag compiled out
+#if defined(__GNUC__) || defined(__clang__)
+#define STR_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define STR_ALWAYS_INLINE inline
+#endif
+
+// the SWAR kernels that need to know which byte of a word is which only do so on little-endian targets
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define STR_SWAR_LE 1
+#else
+#define STR_SWAR_LE 0
+#endif
+
+
+static unsigned short compare_at(char c1, char c2){
+    /* Turn the first pair of chars that differ (or two NULs) into
+       str_compare's return value. A NUL on either side means that string
+       is a prefix of the other one, and the shorter string is the smaller one.
+    */
+    if (c1 == c2){
+        return 1;
     }
-    return count;
-};
+    if (c1 == '\0'){
+        return 2;
+    }
+    if (c2 == '\0'){
+        return 0;
+    }
+    return (c1 < c2) ? 2 : 0;
+}
 
 
-void str_rev(char string_to_reverse[], char string_reversed[]){
-/* Reverse string_to_reverse, writing the result to the string_reversed char array.*/
+CPU_NO_ASAN
+static size_t len_word(const char *s){
+    const char *p = s;
+    uint64_t w;
+
+    // byte at a time until p is 8-aligned
+    for (; (uintptr_t)p % sizeof(uint64_t); p++){
+        if (*p == '\0'){
+            return p - s;
+        }
+    }
+    for (;; p += sizeof(uint64_t)){
+        memcpy(&w, p, sizeof(w));
+        if (WORD_HAS_ZERO(w)){
+            break;
+        }
+    }
+    while (*p != '\0'){
+        p++;
+    }
+    return p - s;
+}
+
 
-    int orig_length = str_len(string_to_reverse);     //  get the length of 'orig'; this doesn't count the terminating NULL character
-    string_reversed[orig_length] = '\0';  // all strings need to be NULL-terminated
+CPU_NO_ASAN
+static long copy_word(char *dst, const char *src){
+    long i = 0;
+    uint64_t w;
 
-    unsigned int ind = 0;
-    for(unsigned i = 0, k = orig_length-1; i < orig_length; i++, k--){
-        string_reversed[k] = string_to_reverse[i];
+    for (; (uintptr_t)(src + i) % sizeof(uint64_t); i++){
+        if (src[i] == '\0'){
+            return i;
+        }
+        dst[i] = src[i];
     }
+    for (;; i += sizeof(uint64_t)){
+        memcpy(&w, src + i, sizeof(w));
+        if (WORD_HAS_ZERO(w)){
+            break;
+        }
+        memcpy(dst + i, &w, sizeof(w));
+    }
+    for (; src[i] != '\0'; i++){
+        dst[i] = src[i];
+    }
+    return i;
 }
 
 
+CPU_NO_ASAN
+static unsigned short compare_word(const char *s1, const char *s2){
+    size_t i = 0;
+    uint64_t w1, w2;
 
-void str_rev_ip(char string_arg[]){
-    /* Reverse the string argument (an array of chars) IN PLACE */
-    
-    unsigned int str_length = str_len(string_arg);  
-    unsigned int largest_index = str_length-1;  // the length is -1 since counting starts at 0. 
-    char temp; 
+    for (; (uintptr_t)(s1 + i) % sizeof(uint64_t); i++){
+        if (s1[i] != s2[i] || s1[i] == '\0'){
+            return compare_at(s1[i], s2[i]);
+        }
+    }
+    for (;;){
+        if (((uintptr_t)(s2 + i) % PAGE_SIZE_MIN) > PAGE_SIZE_MIN - sizeof(uint64_t)){
+            // a word load from s2 would cross a page; do these 8 bytes one at a time
+            for (size_t end = i + sizeof(uint64_t); i < end; i++){
+                if (s1[i] != s2[i] || s1[i] == '\0'){
+                    return compare_at(s1[i], s2[i]);
+                }
+            }
+            continue;
+        }
+        memcpy(&w1, s1 + i, sizeof(w1));
+        memcpy(&w2, s2 + i, sizeof(w2));
+        if (w1 != w2 || WORD_HAS_ZERO(w1)){
+            break;
+        }
+        i += sizeof(uint64_t);
+    }
+    // the difference or the NUL is somewhere in this word
+    while (s1[i] == s2[i] && s1[i] != '\0'){
+        i++;
+    }
+    return compare_at(s1[i], s2[i]);
+}
+
+
+CPU_NO_ASAN
+static const char *find_byte_word(const char *p, const char *end, char c){
+    /* Return a pointer to the first c in [p, end), or end if there's none.
+       Unlike the NUL scanners these are bounded, so they never read past end.
+    */
+    const uint64_t pattern = ONES_64 * (unsigned char)c;
+    uint64_t w;
 
-    if (str_length % 2 == 0){
-        // if the length is even
-        // printf("length is even, %i\n", str_length)
-        for (unsigned int start_index=0, end_index=largest_index; start_index<end_index; start_index++, end_index--){
-            // stop the iteration as soon as start_index < end_index becomes start_index > end_index
-            // which will happen when they both move on from the two median elements
-            temp = string_arg[start_index];
-            string_arg[start_index] = string_arg[end_index];
-            string_arg[end_index] = temp;
+    for (; p + sizeof(uint64_t) <= end; p += sizeof(uint64_t)){
+        memcpy(&w, p, sizeof(w));
+        w ^= pattern;   // bytes equal to c become 0
+        if (WORD_HAS_ZERO(w)){
+            break;
         }
     }
-    else if (str_length % 2 == 1){
-        // if the length is odd
-        // printf("length is odd: %i\n", str_length);
-        for (unsigned int start_index=0, end_index=largest_index; start_index != end_index; start_index++, end_index--){
-            // stop the iteration when start_index and end_index become equal - which will
-            // happen when both indexes reach the median element 
-            temp=string_arg[start_index];
-            string_arg[start_index] = string_arg[end_index];
-            string_arg[end_index] = temp;
+    for (; p < end; p++){
+        if (*p == c){
+            return p;
         }
     }
+    return end;
 }
 
 
+static const char *find_set_word(const char *p, const char *end, const char *set, size_t set_size, const uint8_t set_map[32]){
+    /* Return a pointer to the first char in [p, end) that's in the set of
+       delimiters, or end. set_map has bit (c % 8) of byte (c / 8) set for
+       every delimiter c.
+    */
+    (void)set;
+    (void)set_size;
+    for (; p < end; p++){
+        unsigned char c = *p;
+        if (set_map[c >> 3] & (1u << (c & 7))){
+            return p;
+        }
+    }
+    return end;
+}
+
 
-long str_to_int(char string_arg[]){
-    /* Convert string_arg to an integer, and return that.
+static const char *find_substr_word(const char *p, const char *end, const char *needle, size_t needle_length){
+    /* Return a pointer to the first occurrence of needle (at least 2 chars)
+       in [p, end), or NULL. A position is only a candidate if both the
+       needle's first char and its last char are where they should be; 8
+       positions are tested at once by comparing the word at p with the
+       first char and the word needle_length - 1 further on with the last.
+    */
+    const uint64_t first = ONES_64 * (unsigned char)needle[0];
+    const uint64_t last = ONES_64 * (unsigned char)needle[needle_length - 1];
+    uint64_t w1, w2;
 
-       string_arg must not contain non-numeric characters 
-       or be NULL, and it must be NUL-terminated.
+    for (; (size_t)(end - p) >= needle_length - 1 + sizeof(uint64_t); p += sizeof(uint64_t)){
+        memcpy(&w1, p, sizeof(w1));
+        memcpy(&w2, p + needle_length - 1, sizeof(w2));
+        uint64_t x = (w1 ^ first) | (w2 ^ last);
+        // the high bit of each byte of x that is 0, i.e. of each candidate
+        uint64_t candidates = ~(((x & LOWS_64) + LOWS_64) | x | LOWS_64);
+#if !STR_SWAR_LE
+        candidates = candidates ? HIGHS_64 : 0;    // can't map bits to positions; try all 8
+#endif
+        for (; candidates; candidates &= candidates - 1){
+            size_t i = bit_ctz64(candidates) / 8;
+#if !STR_SWAR_LE
+            // not every one of the 8 is a candidate, so the ends need checking too
+            if (p[i] != needle[0] || p[i + needle_length - 1] != needle[needle_length - 1]){
+                continue;
+            }
+#endif
+            if (memcmp(p + i + 1, needle + 1, needle_length - 2) == 0){
+                return p + i;
+            }
+        }
+    }
+    for (; (size_t)(end - p) >= needle_length; p++){
+        if (p[0] == needle[0] && memcmp(p + 1, needle + 1, needle_length - 1) == 0){
+            return p;
+        }
+    }
+    return NULL;
+}
+
+
+static const char *find_pair_word(const char *p, const char *end, const char *firsts, const char *seconds, size_t num_pairs){
+    /* Return a pointer to the first position in [p, end - 1) where the
+       char there and the one after it are one of the pairs
+       (firsts[k], seconds[k]), or end if there's none
     */
-    long res = 0;    // store the final result
-    unsigned short digit = 0;  // store each digit as it's computed
-    unsigned short sign = 0;   // if 1, add negative sign, if 0, keep positive
-    unsigned short i = 0;  // index;
-    
-    if (string_arg[0] == '-'){
-        sign = 1;   // it's a negative number
-        i = 1;  // start computing after the sign
+    uint64_t packed = 0;
+
+    if (num_pairs == 0){
+        return end;
+    }
+    // the first chars side by side, padded with copies of the first one, to test a char against all of them at once
+    for (size_t k = 0; k < sizeof(uint64_t); k++){
+        packed |= (uint64_t)(unsigned char)firsts[(k < num_pairs) ? k : 0] << (8 * k);
+    }
+    for (; end - p >= 2; p++){
+        uint64_t x = packed ^ (ONES_64 * (unsigned char)p[0]);
+        if (!WORD_HAS_ZERO(x)){
+            continue;
+        }
+        for (size_t k = 0; k < num_pairs; k++){
+            if (p[0] == firsts[k] && p[1] == seconds[k]){
+                return p;
+            }
+        }
     }
+    return end;
+}
 
-    // do this until a NUL is found, which terminates the string
-    for (; string_arg[i] != '\0'; i++){
 
-    // 7 = the offset from '0' to '7' (i.e. = '7' - '0'),
-    // since '7' is equal to '0' + 7
-        digit = string_arg[i] - '0';    
-        // each digit to the right is an order of magnitude lower than the digit to its
-        // left
-        res = res * 10 + digit;     // bump res up one order of magnitude, and add to it the next value to its right
+// block digit parsers for str_parse_long(); see INTEGER PARSING below
+static bool parse8_word(const char *p, uint64_t *value){
+    /* If p[0..8) are all digits, store their value in *value and return true */
+#if STR_SWAR_LE
+    uint64_t w;
+
+    memcpy(&w, p, sizeof(w));
+    // each byte must be 0x30..0x39: high nibble 3, and adding 6 mustn't carry into it
+    if (((w & 0xF0F0F0F0F0F0F0F0ULL) | (((w + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+        != 0x3333333333333333ULL){
+        return false;
     }
-   
-    // negative : make the number negative
-    if (sign){
-        res = 0 - res;  // e.g. -73 is 73 below 0
+    // the first char is the lowest byte: fold pairs, then quads, then the two halves
+    w -= 0x3030303030303030ULL;
+    w = (w * 10) + (w >> 8);
+    w = (((w & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)))
+         + (((w >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    *value = (uint32_t)w;
+    return true;
+#else
+    (void)p;
+    (void)value;
+    return false;
+#endif
+}
+
+
+static bool parse16_word(const char *p, uint64_t *value){
+    uint64_t high, low;
+
+    if (!parse8_word(p, &high) || !parse8_word(p + 8, &low)){
+        return false;
     }
-    return res;
+    *value = high * 100000000ULL + low;
+    return true;
 }
 
 
+static void rev_word(char *dst, const char *src, size_t length){
+    /* dst[0..length) = src[0..length) reversed; they mustn't overlap */
+    size_t i = 0;
 
-char *str_tokenize(char string_arg[], char delimiter){
-    /* Return the next token in string_arg when called.
+    for (; length - i >= 8; i += 8){
+        uint64_t w;
+        memcpy(&w, src + i, sizeof(w));
+        w = __builtin_bswap64(w);
+        memcpy(dst + length - i - 8, &w, sizeof(w));
+    }
+    for (; i < length; i++){
+        dst[length - 1 - i] = src[i];
+    }
+}
 
-       A token is a substring delimitated by delimiter.
-       e.g. 'my_name_is_x' has 4 tokens and 3 delimiters.
 
-       The initial call to the function has to specify the 
-       string to tokenize. After that, unless another string
-       needs to be tokenized, the function is called with NULL
-       as the first argument, to indicate that it should continue
-       tokenizing the same string.
+static void rev_ip_word(char *s, size_t length){
+    /* Reverse s[0..length) in place, swapping a word from each end at a time */
+    char *front = s;
+    char *back = s + length;
 
-       The function maintains internal state by using static variables.
-       Since the whole input string is not tokenized at once, but bit by
-       bit with each call, this is a form of lazy evaluation.
+    for (; back - front >= 16; front += 8, back -= 8){
+        uint64_t w1, w2;
+        memcpy(&w1, front, sizeof(w1));
+        memcpy(&w2, back - 8, sizeof(w2));
+        w1 = __builtin_bswap64(w1);
+        w2 = __builtin_bswap64(w2);
+        memcpy(front, &w2, sizeof(w2));
+        memcpy(back - 8, &w1, sizeof(w1));
+    }
+    // the two ends meet on the middle char (odd length) or cross (even length)
+    for (; back - front >= 2; front++){
+        back--;
+        char temp = *front;
+        *front = *back;
+        *back = temp;
+    }
+}
+
+
+static inline uint64_t flip_case_word(uint64_t w, unsigned char first){
+    /* w with the 0x20 bit flipped in every byte from first to first + 25.
+       Bytes with the high bit set are never letters, so only the low 7 bits
+       go into the range check, which then can't carry between bytes.
     */
+    uint64_t low = w & LOWS_64;
+    uint64_t from_first = low + ONES_64 * (0x80 - first);
+    uint64_t past_last = low + ONES_64 * (0x80 - first - 26);
+    uint64_t letters = from_first & ~past_last & ~w & HIGHS_64;
+    return w ^ (letters >> 2);
+}
+
 
-    // static variables, only initialized when string_arg is not NULL 
-    static char *input_string;
-    static char *token;    // a pointer to the next token found;
-    static long index;
-    static char *res;
+static void case_word(char *dst, const char *src, size_t length, unsigned char first){
+    /* dst[0..length) = src[0..length) with the case of the letters from
+       first to first + 25 flipped: first is 'A' for lowercasing, 'a' for
+       uppercasing. dst can be src.
+    */
+    size_t i = 0;
 
-    // if string_arg is not NULL, (re) initialize the static variables (internal state)
-     if (string_arg){
-        token = string_arg;
-        input_string = string_arg;
-        index = 0;
-        res = NULL;
+    for (; length - i >= 8; i += 8){
+        uint64_t w;
+        memcpy(&w, src + i, sizeof(w));
+        w = flip_case_word(w, first);
+        memcpy(dst + i, &w, sizeof(w));
+    }
+    for (; i < length; i++){
+        unsigned char c = src[i];
+        dst[i] = (unsigned char)(c - first) < 26 ? (char)(c ^ 0x20) : (char)c;
     }
+}
+
+
+static inline unsigned char fold_char(unsigned char c){
+    return (unsigned char)(c - 'A') < 26 ? (unsigned char)(c | 0x20) : c;
+}
 
-   
 
-    while(input_string[index] != '\0'){
-        if (input_string[index] == delimiter){
-            res = token; 
-            input_string[index] = '\0';  // replace the delimiter with a NUL, to terminate the string (token) here
-            token = &input_string[index+1];
-            index++;
+static size_t mismatch_nocase_word(const char *s1, const char *s2, size_t length){
+    /* The first i < length where s1[i] and s2[i] differ ignoring ASCII case, or length */
+    size_t i = 0;
 
-            return res;
+    for (; length - i >= 8; i += 8){
+        uint64_t w1, w2;
+        memcpy(&w1, s1 + i, sizeof(w1));
+        memcpy(&w2, s2 + i, sizeof(w2));
+        if (w1 != w2 && flip_case_word(w1, 'A') != flip_case_word(w2, 'A')){
+            break;
+        }
+    }
+    for (; i < length; i++){
+        if (fold_char(s1[i]) != fold_char(s2[i])){
+            return i;
         }
-        index++;
     }
-    // the loop is exhausted; last token -> return it
-    // NOTE: what's left here is the rest of the original input string from after the last token
-    // until the final Nul
+    return length;
+}
 
-    // return this last bit
-    res = token;
-    // then set token to null, so that on the next call the reurn value is null
-    token = NULL;
-    return res;
+
+#if CPU_X86_DISPATCH
+
+CPU_TARGET("sse2") CPU_NO_ASAN
+static size_t len_sse2(const char *s){
+    size_t misalignment = (uintptr_t)s % 16;
+    const char *p = s - misalignment;
+    const __m128i zero = _mm_setzero_si128();
+
+    // the first aligned block may start before s; shift those bytes out of the mask
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)p), zero));
+    mask >>= misalignment;
+    if (mask){
+        return __builtin_ctz(mask);
+    }
+    for (;;){
+        p += 16;
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)p), zero));
+        if (mask){
+            return (p - s) + __builtin_ctz(mask);
+        }
+    }
 }
 
 
+CPU_TARGET("avx2") CPU_NO_ASAN
+static size_t len_avx2(const char *s){
+    size_t misalignment = (uintptr_t)s % 32;
+    const char *p = s - misalignment;
+    const __m256i zero = _mm256_setzero_si256();
 
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)p), zero));
+    mask >>= misalignment;
+    if (mask){
+        return __builtin_ctz(mask);
+    }
+    for (;;){
+        p += 32;
+        mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)p), zero));
+        if (mask){
+            return (p - s) + __builtin_ctz(mask);
+        }
+    }
+}
+
+
+CPU_TARGET("sse2") CPU_NO_ASAN
+static long copy_sse2(char *dst, const char *src){
+    long i = 0;
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; (uintptr_t)(src + i) % 16; i++){
+        if (src[i] == '\0'){
+            return i;
+        }
+        dst[i] = src[i];
+    }
+    for (;; i += 16){
+        __m128i block = _mm_load_si128((const __m128i *)(src + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, zero))){
+            break;
+        }
+        _mm_storeu_si128((__m128i *)(dst + i), block);
+    }
+    for (; src[i] != '\0'; i++){
+        dst[i] = src[i];
+    }
+    return i;
+}
 
-unsigned short str_count_digits(long num){
-    /* Count digits in num */
-    unsigned short digits = 0;
 
-    while(num){
-        digits++;
-        num /= 10;  // dividing by 10 will get rid of the rightmost digit
+CPU_TARGET("avx2") CPU_NO_ASAN
+static long copy_avx2(char *dst, const char *src){
+    long i = 0;
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (; (uintptr_t)(src + i) % 32; i++){
+        if (src[i] == '\0'){
+            return i;
+        }
+        dst[i] = src[i];
+    }
+    for (;; i += 32){
+        __m256i block = _mm256_load_si256((const __m256i *)(src + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zero))){
+            break;
+        }
+        _mm256_storeu_si256((__m256i *)(dst + i), block);
+    }
+    for (; src[i] != '\0'; i++){
+        dst[i] = src[i];
     }
-    
-    return digits;
+    return i;
 }
 
 
-char *str_from_int(long num){
-    /*Conver num to "num" */
-   
-    // used to find out the size that the array should be, and also used to index the
-    // array afterward, down below in the while loop
-    unsigned short array_size = str_count_digits(num);
-    unsigned short iterations = array_size;    // the number of times the while at the bottom needs to execute
-    unsigned short digit = 0;
-
-    // if num is 0
-    if (!array_size){
-        return NULL;
+CPU_TARGET("sse2") CPU_NO_ASAN
+static unsigned short compare_sse2(const char *s1, const char *s2){
+    size_t i = 0;
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; (uintptr_t)(s1 + i) % 16; i++){
+        if (s1[i] != s2[i] || s1[i] == '\0'){
+            return compare_at(s1[i], s2[i]);
+        }
+    }
+    for (;;){
+        if (((uintptr_t)(s2 + i) % PAGE_SIZE_MIN) > PAGE_SIZE_MIN - 16){
+            for (size_t end = i + 16; i < end; i++){
+                if (s1[i] != s2[i] || s1[i] == '\0'){
+                    return compare_at(s1[i], s2[i]);
+                }
+            }
+            continue;
+        }
+        __m128i b1 = _mm_load_si128((const __m128i *)(s1 + i));
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(s2 + i));
+        // a set bit marks a byte that either differs or is str1's NUL
+        unsigned stop = (~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(b1, b2)) & 0xFFFF)
+                        | (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(b1, zero));
+        if (stop){
+            i += __builtin_ctz(stop);
+            return compare_at(s1[i], s2[i]);
+        }
+        i += 16;
     }
+}
 
-    // the array that will hold the ASCII representation of the digits in num
-    char *res = malloc(sizeof(char) * (array_size+1));
-    if (!res){
-        return NULL;
+
+CPU_TARGET("avx2") CPU_NO_ASAN
+static unsigned short compare_avx2(const char *s1, const char *s2){
+    size_t i = 0;
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (; (uintptr_t)(s1 + i) % 32; i++){
+        if (s1[i] != s2[i] || s1[i] == '\0'){
+            return compare_at(s1[i], s2[i]);
+        }
     }
+    for (;;){
+        if (((uintptr_t)(s2 + i) % PAGE_SIZE_MIN) > PAGE_SIZE_MIN - 32){
+            for (size_t end = i + 32; i < end; i++){
+                if (s1[i] != s2[i] || s1[i] == '\0'){
+                    return compare_at(s1[i], s2[i]);
+                }
+            }
+            continue;
+        }
+        __m256i b1 = _mm256_load_si256((const __m256i *)(s1 + i));
+        __m256i b2 = _mm256_loadu_si256((const __m256i *)(s2 + i));
+        unsigned stop = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b1, b2))
+                        | (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b1, zero));
+        if (stop){
+            i += __builtin_ctz(stop);
+            return compare_at(s1[i], s2[i]);
+        }
+        i += 32;
+    }
+}
 
-    res[array_size] = '\0';     // NUL-terminate the string
-    array_size--;
 
-    digit = num % 10;  // 17 % 10 is 7, and so is  % 10    
-    num /= 10; // drop the rightmost digit
-     // for (unsigned short i = 0, end = array_size; i < end; i++){
-    while(iterations){
-       res[array_size] = '0' + digit;    // convert to ASCII and write to array
-       array_size--;
+CPU_TARGET("sse2")
+static const char *find_byte_sse2(const char *p, const char *end, char c){
+    const __m128i pattern = _mm_set1_epi8(c);
 
-       digit = num % 10;
-       num /= 10;
-       iterations--;
+    for (; end - p >= 16; p += 16){
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), pattern));
+        if (mask){
+            return p + __builtin_ctz(mask);
+        }
     }
-    return res;
+    return find_byte_word(p, end, c);
 }
 
 
-long str_copy(char str1[], char str2[]){
-    /* Copy the contents of str2 into str1 until NULL is encountered.
+CPU_TARGET("avx2")
+static const char *find_byte_avx2(const char *p, const char *end, char c){
+    const __m256i pattern = _mm256_set1_epi8(c);
 
-       Return -1 if any of the strings are NULL (and thus invalid input),
-       or else the value of the index when the copying is done, i.e.
-       where in str1 the process finished.
+    for (; end - p >= 32; p += 32){
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), pattern));
+        if (mask){
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_byte_word(p, end, c);
+}
 
-       This might be useful for knowing exactly where to terminate str1
-       or/and knowing where to continue copying from another string.
 
-       For example, if str1 is 25 chars long and str2 is 10 chars long,
-       str_copy will copy everything in str2 into str1 (10 chars),
-       and then it will stop, because it ran into NUL, the string 
-       terminatior for str2.
-       Str_copy does not terminate str1. Instead, it will return 
-       the value 11, in this case. 
-       The caller can then either insert NULL here and terminate str1
-       ( str1[the_return_value_of_str_copy] = '\0'), or call
-       str_copy with str1 again, and another string.
-       Str_copy will then start copying from str2 and inserting
-       the read items into str1 starting at str1[11].
-    */
-    if (str1 == NULL || str2 == NULL){
-        return -1;
+/* The vector set scanners compare each block against every delimiter
+   and OR the results, so they're only used for small sets
+   (up to STR_TOK_SIMD_SET_MAX delimiters); larger sets go through 
+   find_set_word's bitmap.
+*/
+
+CPU_TARGET("sse2")
+static const char *find_set_sse2(const char *p, const char *end, const char *set, size_t set_size, const uint8_t set_map[32]){
+    __m128i patterns[STR_TOK_SIMD_SET_MAX];
+
+    if (set_size > STR_TOK_SIMD_SET_MAX){
+        return find_set_word(p, end, set, set_size, set_map);
     }
-    long i = 0;
-    for (; str2[i] != '\0'; i++){
-        str1[i] = str2[i];
+    for (size_t k = 0; k < set_size; k++){
+        patterns[k] = _mm_set1_epi8(set[k]);
     }
-    return i;
+    for (; end - p >= 16; p += 16){
+        __m128i block = _mm_loadu_si128((const __m128i *)p);
+        __m128i hits = _mm_setzero_si128();
+        for (size_t k = 0; k < set_size; k++){
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, patterns[k]));
+        }
+        unsigned mask = _mm_movemask_epi8(hits);
+        if (mask){
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_set_word(p, end, set, set_size, set_map);
 }
 
 
+CPU_TARGET("avx2")
+static const char *find_set_avx2(const char *p, const char *end, const char *set, size_t set_size, const uint8_t set_map[32]){
+    __m256i patterns[STR_TOK_SIMD_SET_MAX];
 
-unsigned short str_compare(char str1[], char str2[]){
-    unsigned int str1_length = str_len(str1);
-    unsigned int str2_length = str_len(str2);
-    unsigned int iterations = (str1_length < str2_length) ? str1_length : str2_length;
+    if (set_size > STR_TOK_SIMD_SET_MAX){
+        return find_set_word(p, end, set, set_size, set_map);
+    }
+    for (size_t k = 0; k < set_size; k++){
+        patterns[k] = _mm256_set1_epi8(set[k]);
+    }
+    for (; end - p >= 32; p += 32){
+        __m256i block = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hits = _mm256_setzero_si256();
+        for (size_t k = 0; k < set_size; k++){
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, patterns[k]));
+        }
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hits);
+        if (mask){
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_set_word(p, end, set, set_size, set_map);
+}
 
-    for (unsigned int i = 0; i < iterations; i++){
-        if (str1[i] < str2[i]){
-            return 2;
+/* The vector substring kernels are find_substr_word's first/last char
+   filter 16/32 positions at a time (W. Mula's "SIMD-friendly" search).
+*/
+
+CPU_TARGET("sse2")
+static const char *find_substr_sse2(const char *p, const char *end, const char *needle, size_t needle_length){
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+
+    for (; (size_t)(end - p) >= needle_length - 1 + 16; p += 16){
+        __m128i block_first = _mm_loadu_si128((const __m128i *)p);
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(p + needle_length - 1));
+        unsigned candidates = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                                                                          _mm_cmpeq_epi8(block_last, last)));
+        for (; candidates; candidates &= candidates - 1){
+            size_t i = __builtin_ctz(candidates);
+            if (memcmp(p + i + 1, needle + 1, needle_length - 2) == 0){
+                return p + i;
+            }
         }
-        else if (str1[i] > str2[i]){
-            return 0;
+    }
+    return find_substr_word(p, end, needle, needle_length);
+}
+
+
+CPU_TARGET("avx2")
+static const char *find_substr_avx2(const char *p, const char *end, const char *needle, size_t needle_length){
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+
+    for (; (size_t)(end - p) >= needle_length - 1 + 32; p += 32){
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)p);
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)(p + needle_length - 1));
+        unsigned candidates = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block_first, first),
+                                                                                _mm256_cmpeq_epi8(block_last, last)));
+        for (; candidates; candidates &= candidates - 1){
+            size_t i = __builtin_ctz(candidates);
+            if (memcmp(p + i + 1, needle + 1, needle_length - 2) == 0){
+                return p + i;
+            }
         }
     }
-    // if the flow of control gets to this point without having already
-    // returned 0 or 2, then the strings are equal. Compare the lengths
-    if (str1_length < str2_length){
-        return 2;
+    return find_substr_word(p, end, needle, needle_length);
+}
+
+
+CPU_TARGET("sse2")
+static const char *find_pair_sse2(const char *p, const char *end, const char *firsts, const char *seconds, size_t num_pairs){
+    __m128i first[STR_TOK_SIMD_SET_MAX], second[STR_TOK_SIMD_SET_MAX];
+
+    for (size_t k = 0; k < num_pairs; k++){
+        first[k] = _mm_set1_epi8(firsts[k]);
+        second[k] = _mm_set1_epi8(seconds[k]);
     }
-    else if (str1_length > str2_length){
-        return 0;
+    for (; end - p >= 17; p += 16){
+        __m128i block0 = _mm_loadu_si128((const __m128i *)p);
+        __m128i block1 = _mm_loadu_si128((const __m128i *)(p + 1));
+        __m128i hits = _mm_setzero_si128();
+        for (size_t k = 0; k < num_pairs; k++){
+            hits = _mm_or_si128(hits, _mm_and_si128(_mm_cmpeq_epi8(block0, first[k]), _mm_cmpeq_epi8(block1, second[k])));
+        }
+        unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+        if (mask){
+            return p + __builtin_ctz(mask);
+        }
     }
-    else{
-        //strings are identical
-        return 1;
+    return find_pair_word(p, end, firsts, seconds, num_pairs);
+}
+
+
+CPU_TARGET("avx2")
+static const char *find_pair_avx2(const char *p, const char *end, const char *firsts, const char *seconds, size_t num_pairs){
+    __m256i first[STR_TOK_SIMD_SET_MAX], second[STR_TOK_SIMD_SET_MAX];
+
+    for (size_t k = 0; k < num_pairs; k++){
+        first[k] = _mm256_set1_epi8(firsts[k]);
+        second[k] = _mm256_set1_epi8(seconds[k]);
+    }
+    for (; end - p >= 33; p += 32){
+        __m256i block0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i block1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+        __m256i hits = _mm256_setzero_si256();
+        for (size_t k = 0; k < num_pairs; k++){
+            hits = _mm256_or_si256(hits, _mm256_and_si256(_mm256_cmpeq_epi8(block0, first[k]),
+                                                          _mm256_cmpeq_epi8(block1, second[k])));
+        }
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hits);
+        if (mask){
+            return p + __builtin_ctz(mask);
+        }
     }
+    _mm256_zeroupper();     // the tail is SSE2 code, which stalls on dirty upper halves
+    return find_pair_sse2(p, end, firsts, seconds, num_pairs);
 }
 
 
+CPU_TARGET("avx2")
+static bool parse16_avx2(const char *p, uint64_t *value){
+    __m128i digits = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)p), _mm_set1_epi8('0'));
+    const __m128i nine = _mm_set1_epi8(9);
 
-bool str_is_same(char str1[], char str2[]){
-    unsigned short res = str_compare(str1, str2);
-    // str_compare returns 1 if str1 and str2 are identical
-    if (res == 1){
-        return true;
-    }else{
+    // chars below '0' wrap around to large values, so one unsigned max catches both ends
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(digits, nine), nine)) != 0xFFFF){
         return false;
     }
+    __m128i pairs = _mm_maddubs_epi16(digits, _mm_set_epi8(1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10));
+    __m128i quads = _mm_madd_epi16(pairs, _mm_set_epi16(1, 100, 1, 100, 1, 100, 1, 100));
+    quads = _mm_packus_epi32(quads, quads);
+    __m128i eights = _mm_madd_epi16(quads, _mm_set_epi16(1, 10000, 1, 10000, 1, 10000, 1, 10000));
+
+    *value = (uint64_t)(uint32_t)_mm_cvtsi128_si32(eights) * 100000000ULL
+             + (uint32_t)_mm_extract_epi32(eights, 1);
+    return true;
+}
+
+
+
+CPU_TARGET("sse2")
+static inline __m128i rev16_sse2(__m128i v){
+    /* v's 16 bytes in reverse order: dwords, then the words in each, then the bytes in each */
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+
+CPU_TARGET("sse2")
+static void rev_sse2(char *dst, const char *src, size_t length){
+    size_t i = 0;
+
+    for (; length - i >= 16; i += 16){
+        __m128i block = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + length - i - 16), rev16_sse2(block));
+    }
+    rev_word(dst, src + i, length - i);
+}
+
+
+CPU_TARGET("sse2")
+static void rev_ip_sse2(char *s, size_t length){
+    char *front = s;
+    char *back = s + length;
+
+    for (; back - front >= 32; front += 16, back -= 16){
+        __m128i block1 = _mm_loadu_si128((const __m128i *)front);
+        __m128i block2 = _mm_loadu_si128((const __m128i *)(back - 16));
+        _mm_storeu_si128((__m128i *)front, rev16_sse2(block2));
+        _mm_storeu_si128((__m128i *)(back - 16), rev16_sse2(block1));
+    }
+    rev_ip_word(front, back - front);
+}
+
+
+CPU_TARGET("avx2")
+static inline __m256i rev32_avx2(__m256i v){
+    /* Reverse the bytes in each 128-bit lane, then swap the lanes */
+    const __m256i reverse = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                             15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    return _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, reverse), _MM_SHUFFLE(1, 0, 3, 2));
 }
 
 
+CPU_TARGET("avx2")
+static void rev_avx2(char *dst, const char *src, size_t length){
+    size_t i = 0;
+
+    for (; length - i >= 32; i += 32){
+        __m256i block = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + length - i - 32), rev32_avx2(block));
+    }
+    _mm256_zeroupper();
+    rev_word(dst, src + i, length - i);
+}
+
 
+CPU_TARGET("avx2")
+static void rev_ip_avx2(char *s, size_t length){
+    char *front = s;
+    char *back = s + length;
 
+    for (; back - front >= 64; front += 32, back -= 32){
+        __m256i block1 = _mm256_loadu_si256((const __m256i *)front);
+        __m256i block2 = _mm256_loadu_si256((const __m256i *)(back - 32));
+        _mm256_storeu_si256((__m256i *)front, rev32_avx2(block2));
+        _mm256_storeu_si256((__m256i *)(back - 32), rev32_avx2(block1));
+    }
+    _mm256_zeroupper();
+    rev_ip_word(front, back - front);
+}
 
+
+
+CPU_TARGET("sse2")
+static inline __m128i flip_case_sse2(__m128i v, unsigned char first){
+    // v - first is 0..25 for the letters; shifted down by 128 they're the only bytes below -102 as signed chars
+    __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8((char)(first + 128)));
+    __m128i letters = _mm_cmplt_epi8(shifted, _mm_set1_epi8(-128 + 26));
+    return _mm_xor_si128(v, _mm_and_si128(letters, _mm_set1_epi8(0x20)));
+}
+
+
+CPU_TARGET("sse2")
+static void case_sse2(char *dst, const char *src, size_t length, unsigned char first){
+    size_t i = 0;
+
+    for (; length - i >= 16; i += 16){
+        __m128i block = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), flip_case_sse2(block, first));
+    }
+    case_word(dst + i, src + i, length - i, first);
+}
+
+
+CPU_TARGET("sse2")
+static size_t mismatch_nocase_sse2(const char *s1, const char *s2, size_t length){
+    size_t i = 0;
+
+    for (; length - i >= 16; i += 16){
+        __m128i block1 = flip_case_sse2(_mm_loadu_si128((const __m128i *)(s1 + i)), 'A');
+        __m128i block2 = flip_case_sse2(_mm_loadu_si128((const __m128i *)(s2 + i)), 'A');
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block1, block2)) ^ 0xFFFF;
+        if (mask){
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + mismatch_nocase_word(s1 + i, s2 + i, length - i);
+}
+
+
+CPU_TARGET("avx2")
+static inline __m256i flip_case_avx2(__m256i v, unsigned char first){
+    __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8((char)(first + 128)));
+    __m256i letters = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 26), shifted);
+    return _mm256_xor_si256(v, _mm256_and_si256(letters, _mm256_set1_epi8(0x20)));
+}
+
+
+CPU_TARGET("avx2")
+static void case_avx2(char *dst, const char *src, size_t length, unsigned char first){
+    size_t i = 0;
+
+    for (; length - i >= 32; i += 32){
+        __m256i block = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), flip_case_avx2(block, first));
+    }
+    _mm256_zeroupper();
+    case_word(dst + i, src + i, length - i, first);
+}
+
+
+CPU_TARGET("avx2")
+static size_t mismatch_nocase_avx2(const char *s1, const char *s2, size_t length){
+    size_t i = 0;
+
+    for (; length - i >= 32; i += 32){
+        __m256i block1 = flip_case_avx2(_mm256_loadu_si256((const __m256i *)(s1 + i)), 'A');
+        __m256i block2 = flip_case_avx2(_mm256_loadu_si256((const __m256i *)(s2 + i)), 'A');
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block1, block2));
+        if (mask){
+            _mm256_zeroupper();
+            return i + __builtin_ctz(mask);
+        }
+    }
+    _mm256_zeroupper();
+    return i + mismatch_nocase_word(s1 + i, s2 + i, length - i);
+}
+
+#endif  // CPU_X86_DISPATCH
+
+
+// the kernels in use; the word-at-a-time ones until str_init_kernels() has run
+static size_t (*len_kernel)(const char *) = len_word;
+static long (*copy_kernel)(char *, const char *) = copy_word;
+static unsigned short (*compare_kernel)(const char *, const char *) = compare_word;
+static const char *(*find_byte_kernel)(const char *, const char *, char) = find_byte_word;
+static const char *(*find_set_kernel)(const char *, const char *, const char *, size_t, const uint8_t *) = find_set_word;
+static bool (*parse16_kernel)(const char *, uint64_t *) = parse16_word;
+static const char *(*find_substr_kernel)(const char *, const char *, const char *, size_t) = find_substr_word;
+static const char *(*find_pair_kernel)(const char *, const char *, const char *, const char *, size_t) = find_pair_word;
+static void (*rev_kernel)(char *, const char *, size_t) = rev_word;
+static void (*rev_ip_kernel)(char *, size_t) = rev_ip_word;
+static void (*case_kernel)(char *, const char *, size_t, unsigned char) = case_word;
+static size_t (*mismatch_nocase_kernel)(const char *, const char *, size_t) = mismatch_nocase_word;
+
+
+CPU_CONSTRUCTOR
+static void str_init_kernels(void){
+    /* Point the kernel pointers at the widest versions this CPU supports.
+       Runs once, before main(), on compilers that support constructors;
+       elsewhere the portable kernels stay in place.
+    */
+#if CPU_X86_DISPATCH
+    switch (cpu_simd_level()){
+        case SIMD_AVX2:
+            len_kernel = len_avx2;
+            copy_kernel = copy_avx2;
+            compare_kernel = compare_avx2;
+            find_byte_kernel = find_byte_avx2;
+            find_set_kernel = find_set_avx2;
+            find_substr_kernel = find_substr_avx2;
+            find_pair_kernel = find_pair_avx2;
+            parse16_kernel = parse16_avx2;
+            rev_kernel = rev_avx2;
+            rev_ip_kernel = rev_ip_avx2;
+            case_kernel = case_avx2;
+            mismatch_nocase_kernel = mismatch_nocase_avx2;
+            break;
+        case SIMD_SSE2:
+            len_kernel = len_sse2;
+            copy_kernel = copy_sse2;
+            compare_kernel = compare_sse2;
+            find_byte_kernel = find_byte_sse2;
+            find_set_kernel = find_set_sse2;
+            find_substr_kernel = find_substr_sse2;
+            find_pair_kernel = find_pair_sse2;
+            rev_kernel = rev_sse2;
+            rev_ip_kernel = rev_ip_sse2;
+            case_kernel = case_sse2;
+            mismatch_nocase_kernel = mismatch_nocase_sse2;
+            break;
+        default:
+            break;
+    }
+#endif
+}
+
+
+
+unsigned int str_len(char string_arg[]){
+/* Find and return the length of string_arg. 
+
+   A string ends when Nul is encountered, i.e.
+   all strings are Nul-terminated. If a char array
+   is not Nul terminated, then it's not a string,
+   and the length can't be determined correctly.
+*/
+    unsigned int length = len_kernel(string_arg);
+    INSTR_RECORD(INSTR_STR_LEN, length);
+    return length;
+};
+
+
+void str_rev_n(const char string_to_reverse[], size_t length, char string_reversed[]){
+/* Reverse the first length chars of string_to_reverse, writing the result
+   to the string_reversed char array, and NUL-terminate it. The two mustn't
+   overlap; use str_rev_ip_n() to reverse a string in place.
+*/
+    rev_kernel(string_reversed, string_to_reverse, length);
+    string_reversed[length] = '\0';  // all strings need to be NULL-terminated
+}
+
+
+void str_rev(char string_to_reverse[], char string_reversed[]){
+/* Reverse string_to_reverse, writing the result to the string_reversed char array.*/
+    str_rev_n(string_to_reverse, str_len(string_to_reverse), string_reversed);
+}
+
+
+
+void str_rev_ip_n(char string_arg[], size_t length){
+    /* Reverse the first length chars of string_arg IN PLACE.
+
+       Blocks from the two ends are swapped and reversed until they meet
+       in the middle, where the last few chars are swapped one by one.
+    */
+    rev_ip_kernel(string_arg, length);
+}
+
+
+void str_rev_ip(char string_arg[]){
+    /* Reverse the string argument (an array of chars) IN PLACE */
+    str_rev_ip_n(string_arg, str_len(string_arg));
+}
+
+
+/* UTF-8 reversal keeps the bytes of each code point in order and reverses
+   the order of the code points, so "añb" becomes "bña" rather than a mess
+   of swapped continuation bytes. A lead byte followed by the number of
+   continuation bytes it announces is one code point. Anything else (a
+   stray continuation byte, a truncated sequence) doesn't form one and is
+   treated as a single byte, so invalid input is still reversed byte by
+   byte instead of being rejected.
+*/
+
+static size_t utf8_sequence_length(const unsigned char *p, size_t available){
+    /* The length of the code point at p, or 1 if it isn't well-formed */
+    size_t length = (p[0] >= 0xF0 && p[0] <= 0xF4) ? 4
+                  : (p[0] >= 0xE0 && p[0] < 0xF0) ? 3
+                  : (p[0] >= 0xC2 && p[0] < 0xE0) ? 2 : 1;
+
+    if (length > available){
+        return 1;
+    }
+    for (size_t k = 1; k < length; k++){
+        if ((p[k] & 0xC0) != 0x80){
+            return 1;
+        }
+    }
+    return length;
+}
+
+
+void str_rev_utf8_n(const char string_to_reverse[], size_t length, char string_reversed[]){
+    /* Reverse the first length chars of string_to_reverse code point by
+       code point, writing the result to string_reversed and NUL-terminating
+       it. The two mustn't overlap. Runs of ASCII are reversed a word at a time.
+    */
+    const unsigned char *src = (const unsigned char *)string_to_reverse;
+    size_t i = 0;
+
+    while (i < length){
+        uint64_t w;
+        if (length - i >= 8 && (memcpy(&w, src + i, sizeof(w)), (w & HIGHS_64) == 0)){
+            w = __builtin_bswap64(w);
+            memcpy(string_reversed + length - i - 8, &w, sizeof(w));
+            i += 8;
+            continue;
+        }
+        size_t n = utf8_sequence_length(src + i, length - i);
+        memcpy(string_reversed + length - i - n, src + i, n);
+        i += n;
+    }
+    string_reversed[length] = '\0';
+}
+
+
+void str_rev_utf8_ip_n(char string_arg[], size_t length){
+    /* Reverse the first length chars of string_arg code point by code point,
+       IN PLACE: the bytes of every multi-byte code point are reversed first,
+       so that reversing the whole buffer afterwards puts them back in order.
+    */
+    unsigned char *s = (unsigned char *)string_arg;
+    size_t i = 0;
+
+    while (i < length){
+        uint64_t w;
+        if (length - i >= 8 && (memcpy(&w, s + i, sizeof(w)), (w & HIGHS_64) == 0)){
+            i += 8;     // all ASCII
+            continue;
+        }
+        size_t n = utf8_sequence_length(s + i, length - i);
+        if (n > 1){
+            rev_ip_word(string_arg + i, n);
+        }
+        i += n;
+    }
+    rev_ip_kernel(string_arg, length);
+}
+
+
+void str_rev_utf8(char string_to_reverse[], char string_reversed[]){
+    str_rev_utf8_n(string_to_reverse, str_len(string_to_reverse), string_reversed);
+}
+
+
+void str_rev_utf8_ip(char string_arg[]){
+    str_rev_utf8_ip_n(string_arg, str_len(string_arg));
+}
+
+
+
+/*                              * * *
+   INTEGER PARSING
+
+   Digits are converted in blocks wherever the input allows it: 16 at a time
+   with SSE (AVX2-class CPUs only, since it needs PMADDUBSW and PACKUSDW),
+   8 at a time with a SWAR multiply on little-endian machines, and one at
+   a time for whatever is left. A block is only taken if every byte in it
+   is a digit, so the block paths never have to find where the number ends.
+
+   The magnitude is accumulated as an unsigned 64-bit value and checked
+   against LONG_MAX (or -LONG_MIN) before each block is added, so overflow
+   is caught without relying on signed wraparound.
+*/
+
+static bool accumulate(uint64_t *magnitude, uint64_t block, uint64_t scale, uint64_t limit){
+    /* *magnitude = *magnitude * scale + block, unless that would exceed limit */
+    if (block > limit || *magnitude > (limit - block) / scale){
+        return false;
+    }
+    *magnitude = *magnitude * scale + block;
+    return true;
+}
+
+
+str_parse_err str_parse_long(const char string_arg[], size_t length, long *value, size_t *consumed){
+    /* Parse the integer at the start of string_arg: an optional '-' or '+'
+       followed by one or more digits. string_arg doesn't need to be
+       NUL-terminated, and parsing stops at the first non-digit.
+
+       *value gets the integer and *consumed the number of chars it took
+       up, sign included. The return value says how it went:
+            STR_PARSE_OK        all length chars were part of the number
+            STR_PARSE_BAD_CHAR  string_arg[*consumed] isn't a digit; *value
+                                holds the number before it
+            STR_PARSE_EMPTY     there were no digits at all; *value is 0 and
+                                *consumed counts the sign, if there was one
+            STR_PARSE_OVERFLOW  the number doesn't fit in a long; *value is
+                                LONG_MAX or LONG_MIN and *consumed still
+                                covers all of its digits
+       Either pointer can be NULL if the caller doesn't need it.
+    */
+    size_t i = 0;
+    bool negative = false;
+    bool overflow = false;
+    uint64_t magnitude = 0;
+    uint64_t block;
+    // -LONG_MIN doesn't fit in a long, but it does in a uint64_t
+    uint64_t limit = (uint64_t)LONG_MAX;
+
+    if (length > 0 && (string_arg[0] == '-' || string_arg[0] == '+')){
+        negative = (string_arg[0] == '-');
+        limit += negative;
+        i = 1;
+    }
+    size_t digits_start = i;
+
+    for (; length - i >= 16 && parse16_kernel(string_arg + i, &block); i += 16){
+        if (!accumulate(&magnitude, block, 10000000000000000ULL, limit)){
+            overflow = true;
+            break;
+        }
+    }
+    for (; !overflow && length - i >= 8 && parse8_word(string_arg + i, &block); i += 8){
+        if (!accumulate(&magnitude, block, 100000000ULL, limit)){
+            overflow = true;
+            break;
+        }
+    }
+    for (; i < length && (unsigned)(string_arg[i] - '0') <= 9; i++){
+        if (!overflow && !accumulate(&magnitude, string_arg[i] - '0', 10, limit)){
+            overflow = true;
+        }
+    }
+    // a block that overflowed was left unconsumed; skip whatever digits remain
+    while (i < length && (unsigned)(string_arg[i] - '0') <= 9){
+        i++;
+    }
+
+    str_parse_err res;
+    long result;
+    if (overflow){
+        res = STR_PARSE_OVERFLOW;
+        result = negative ? LONG_MIN : LONG_MAX;
+    }
+    else{
+        res = (i == digits_start) ? STR_PARSE_EMPTY : (i < length) ? STR_PARSE_BAD_CHAR : STR_PARSE_OK;
+        // 0 - magnitude in unsigned arithmetic, so that -LONG_MIN converts back cleanly
+        result = negative ? (long)(0 - magnitude) : (long)magnitude;
+    }
+    if (value){
+        *value = result;
+    }
+    if (consumed){
+        *consumed = i;
+    }
+    INSTR_RECORD(INSTR_STR_PARSE_LEN, i);
+    return res;
+}
+
+
+size_t str_parse_longs(const char buf[], size_t length, char delimiter,
+                       long values[], size_t max_values, str_parse_err *error, size_t *consumed){
+    /* Parse a buffer of integers separated by delimiter, e.g. "12,-7,300",
+       storing them in values, and return how many were stored. A delimiter
+       right at the end of buf is allowed, so "12,-7,300," is the same list.
+
+       Parsing stops at the end of buf, once max_values have been stored,
+       or at the first field that isn't a valid integer. *error gets
+       STR_PARSE_OK in the first two cases and the field's error otherwise
+       (STR_PARSE_EMPTY for an empty field, STR_PARSE_BAD_CHAR if anything
+       other than the delimiter follows the digits). *consumed gets where
+       parsing stopped: the end of buf, the start of the first field not
+       parsed, or the position of the error, so a full values array can be
+       continued from buf + *consumed.
+       Either out-pointer can be NULL.
+    */
+    size_t position = 0;
+    size_t count = 0;
+    str_parse_err res = STR_PARSE_OK;
+
+    while (position < length && count < max_values){
+        size_t field_length;
+        res = str_parse_long(buf + position, length - position, &values[count], &field_length);
+
+        if (res == STR_PARSE_BAD_CHAR && buf[position + field_length] == delimiter){
+            res = STR_PARSE_OK;     // the number just ends at the delimiter
+        }
+        if (res == STR_PARSE_EMPTY && field_length < length - position
+            && buf[position + field_length] != delimiter){
+            res = STR_PARSE_BAD_CHAR;   // e.g. "abc": there's something there, just not a number
+        }
+        if (res != STR_PARSE_OK){
+            position += field_length;
+            break;
+        }
+        count++;
+        position += field_length;
+        if (position < length){
+            position++;     // step over the delimiter
+        }
+    }
+    if (error){
+        *error = res;
+    }
+    if (consumed){
+        *consumed = position;
+    }
+    return count;
+}
+
+
+long str_to_int_n(const char string_arg[], size_t length){
+    /* Convert the first length chars of string_arg to an integer, and return that.
+
+       The chars must not include non-numeric characters, other than
+       a leading '-'. string_arg doesn't need to be NUL-terminated.
+       If they do, the number before the first one is returned; out of
+       range values come back as LONG_MAX/LONG_MIN. Use str_parse_long()
+       to find out whether either happened.
+    */
+    long res = 0;
+    str_parse_long(string_arg, length, &res, NULL);
+    return res;
+}
+
+
+long str_to_int(char string_arg[]){
+    /* Convert string_arg to an integer, and return that.
+
+       string_arg must not contain non-numeric characters
+       or be NULL, and it must be NUL-terminated.
+    */
+    return str_to_int_n(string_arg, str_len(string_arg));
+}
+
+
+
+/*                              * * *
+   SEARCHING
+
+   A needle of one char is just a byte scan. Needles of up to
+   STR_FIND_FILTER_MAX chars go through the first/last char filter
+   kernels: on typical text, only a tiny share of the positions pass both
+   chars, and only those are compared in full. Its worst case is bounded
+   by the needle length, which is why longer needles use Two-Way instead
+   (Crochemore and Perrin, after musl's strstr): O(haystack + needle)
+   time whatever the input, O(1) extra space beyond a 256-entry shift table,
+   and it still skips ahead by up to a needle's length on a mismatch.
+*/
+
+#define STR_FIND_FILTER_MAX 32
+
+typedef struct two_way TwoWay;
+
+struct two_way{
+    const unsigned char *needle;
+    size_t length;
+    size_t critical;    // the needle is factorized into [0, critical] and (critical, length)
+    size_t period;
+    size_t memory0;     // how much of a periodic needle is known to match after a shift by period
+    size_t shift[256];  // 1 + the last position of each char in the needle, 0 if it isn't in it
+};
+
+
+static size_t maximal_suffix(const unsigned char *n, size_t l, bool reversed, size_t *period){
+    /* Start of the maximal suffix of n (minus one; it wraps to SIZE_MAX
+       for the whole string) under the byte order, or the reversed order,
+       and its period.
+    */
+    size_t ip = SIZE_MAX, jp = 0, k = 1, p = 1;
+
+    while (jp + k < l){
+        unsigned char a = n[ip + k], b = n[jp + k];
+        if (a == b){
+            if (k == p){
+                jp += p;
+                k = 1;
+            }
+            else{
+                k++;
+            }
+        }
+        else if (reversed ? (a < b) : (a > b)){
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        }
+        else{
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    *period = p;
+    return ip;
+}
+
+
+static void two_way_init(TwoWay *tw, const char needle[], size_t length){
+    const unsigned char *n = (const unsigned char *)needle;
+    size_t p0, p1;
+
+    tw->needle = n;
+    tw->length = length;
+    memset(tw->shift, 0, sizeof(tw->shift));
+    for (size_t i = 0; i < length; i++){
+        tw->shift[n[i]] = i + 1;
+    }
+    // the critical factorization is the later of the two maximal suffixes
+    size_t ms0 = maximal_suffix(n, length, false, &p0);
+    size_t ms1 = maximal_suffix(n, length, true, &p1);
+    if (ms1 + 1 > ms0 + 1){
+        tw->critical = ms1;
+        tw->period = p1;
+    }
+    else{
+        tw->critical = ms0;
+        tw->period = p0;
+    }
+    if (memcmp(n, n + tw->period, tw->critical + 1) != 0){
+        // not periodic: any shift up to the longer half is safe
+        size_t left = tw->critical + 1, right = length - tw->critical - 1;
+        tw->period = ((left > right) ? left : right) + 1;
+        tw->memory0 = 0;
+    }
+    else{
+        tw->memory0 = length - tw->period;
+    }
+}
+
+
+static const char *two_way_find(const TwoWay *tw, const char *haystack, const char *end){
+    /* The first occurrence of tw's needle in [haystack, end), or NULL */
+    const unsigned char *h = (const unsigned char *)haystack;
+    const unsigned char *n = tw->needle;
+    size_t l = tw->length, ms = tw->critical, mem = 0, k;
+
+    while ((size_t)((const unsigned char *)end - h) >= l){
+        // look at the char under the needle's last one first, and skip past it if it can't match
+        k = l - tw->shift[h[l - 1]];
+        if (k){
+            h += (k < mem) ? mem : k;
+            mem = 0;
+            continue;
+        }
+        // the right half, left to right
+        for (k = (ms + 1 > mem) ? ms + 1 : mem; k < l && n[k] == h[k]; k++);
+        if (k < l){
+            h += k - ms;
+            mem = 0;
+            continue;
+        }
+        // the left half, right to left
+        for (k = ms + 1; k > mem && n[k - 1] == h[k - 1]; k--);
+        if (k <= mem){
+            return (const char *)h;
+        }
+        h += tw->period;
+        mem = tw->memory0;
+    }
+    return NULL;
+}
+
+
+static const char *find_n(const char haystack[], size_t length, const char needle[], size_t needle_length){
+    if (needle_length == 0){
+        return haystack;
+    }
+    if (needle_length > length){
+        return NULL;
+    }
+    if (needle_length == 1){
+        const char *found = find_byte_kernel(haystack, haystack + length, needle[0]);
+        return (found == haystack + length) ? NULL : found;
+    }
+    if (needle_length <= STR_FIND_FILTER_MAX){
+        return find_substr_kernel(haystack, haystack + length, needle, needle_length);
+    }
+    TwoWay tw;
+    two_way_init(&tw, needle, needle_length);
+    return two_way_find(&tw, haystack, haystack + length);
+}
+
+
+const char *str_find_n(const char haystack[], size_t length, const char needle[], size_t needle_length){
+    /* Return a pointer to the first occurrence of needle in haystack, or
+       NULL if there's none. An empty needle is found at the start.
+    */
+    INSTR_RECORD(INSTR_STR_FIND_LEN, length);
+    return find_n(haystack, length, needle, needle_length);
+}
+
+
+char *str_find(char haystack[], char needle[]){
+    size_t length = len_kernel(haystack);
+    INSTR_RECORD(INSTR_STR_FIND_LEN, length);
+    return (char *)find_n(haystack, length, needle, len_kernel(needle));
+}
+
+
+size_t str_count_occurrences_n(const char haystack[], size_t length, const char needle[], size_t needle_length){
+    /* Count the occurrences of needle in haystack that don't overlap, left
+       to right ("aa" is in "aaaa" twice). An empty needle is never counted.
+    */
+    const char *p = haystack, *end = haystack + length;
+    size_t count = 0;
+    TwoWay tw;
+
+    if (needle_length == 0){
+        return 0;
+    }
+    if (needle_length > STR_FIND_FILTER_MAX){
+        two_way_init(&tw, needle, needle_length);   // once, not per occurrence
+    }
+    for (;;){
+        const char *found = (needle_length > STR_FIND_FILTER_MAX) ? two_way_find(&tw, p, end)
+                            : find_n(p, (size_t)(end - p), needle, needle_length);
+        if (!found){
+            return count;
+        }
+        count++;
+        p = found + needle_length;
+    }
+}
+
+
+size_t str_count_occurrences(char haystack[], char needle[]){
+    return str_count_occurrences_n(haystack, len_kernel(haystack), needle, len_kernel(needle));
+}
+
+
+static void build_set_map(uint8_t set_map[32], const char set[], size_t set_size){
+    memset(set_map, 0, 32);
+    for (size_t i = 0; i < set_size; i++){
+        unsigned char c = set[i];
+        set_map[c >> 3] |= 1u << (c & 7);
+    }
+}
+
+
+const char *str_find_any_n(const char haystack[], size_t length, const char set[], size_t set_size){
+    /* Return a pointer to the first char of haystack that's one of the
+       set_size chars in set, or NULL. Small sets are scanned with vector
+       compares, like STR_TOK_SET tokenizers.
+    */
+    uint8_t set_map[32];
+    build_set_map(set_map, set, set_size);
+    const char *found = find_set_kernel(haystack, haystack + length, set, set_size, set_map);
+    return (found == haystack + length) ? NULL : found;
+}
+
+
+char *str_find_any(char haystack[], char set[]){
+    return (char *)str_find_any_n(haystack, len_kernel(haystack), set, len_kernel(set));
+}
+
+
+
+/*                              * * *
+   MULTI-PATTERN SEARCH
+
+   StrMatcher is an Aho-Corasick automaton compiled into a full DFA: one
+   table lookup per input char, with no failure links to chase at match
+   time. To keep the table small, the columns are byte classes rather
+   than bytes: each byte that occurs in some pattern is a class of its
+   own, and all the other bytes share class 0 (so binary patterns using
+   every byte value make 257 classes). A transition holds the target
+   state's row offset in the table, so stepping needs no multiply, with
+   MATCHER_OUTPUT set if some pattern ends in the target state.
+
+   Most of the text is usually spent in the start state, waiting for the
+   start of some pattern, so that state is left with a vector scan
+   instead, 16/32 positions at a time: for the first two chars of the
+   patterns if there are no more than STR_TOK_SIMD_SET_MAX different
+   pairs of them (and no pattern of a single char), or else for their
+   first chars if there are no more than that many of those. A single
+   char is a weak filter on real text (think of keywords starting with
+   'e' or 't'), hence the pairs. Where the scan keeps stopping almost
+   right away anyway, it's paused for a while and the DFA runs alone.
+*/
+
+#define MATCHER_OUTPUT 0x80000000u
+#define MATCHER_MIN_SKIP 8      // a scan that moved less than this didn't pay
+#define MATCHER_BACKOFF 64      // chars to go without scanning after one that didn't
+
+
+bool str_matcher_init(StrMatcher *matcher, const char *const patterns[], const size_t lengths[], size_t count){
+    /* Compile the count patterns into matcher. The patterns are only read
+       here, so they don't have to outlive it. Return false if a pattern
+       is empty or the memory can't be allocated.
+    */
+    size_t max_states = 1;
+    uint32_t *fail = NULL, *queue = NULL;
+
+    memset(matcher, 0, sizeof(*matcher));
+    matcher->num_classes = 1;
+    for (size_t i = 0; i < count; i++){
+        if (lengths[i] == 0){
+            return false;
+        }
+        max_states += lengths[i];
+        for (size_t j = 0; j < lengths[i]; j++){
+            unsigned char c = patterns[i][j];
+            if (!matcher->classes[c]){
+                matcher->classes[c] = (uint16_t)matcher->num_classes++;
+            }
+        }
+    }
+    if (max_states > (MATCHER_OUTPUT - 1) / matcher->num_classes){
+        return false;   // row offsets wouldn't fit next to the flag
+    }
+    size_t num_classes = matcher->num_classes;
+    uint32_t *transitions = calloc(max_states * num_classes, sizeof(uint32_t));
+    uint32_t *outputs = calloc(max_states, sizeof(uint32_t));
+    size_t *pattern_lengths = malloc((count ? count : 1) * sizeof(size_t));
+    fail = malloc(max_states * sizeof(uint32_t));
+    queue = malloc(max_states * sizeof(uint32_t));
+    if (!transitions || !outputs || !pattern_lengths || !fail || !queue){
+        free(transitions);
+        free(outputs);
+        free(pattern_lengths);
+        free(fail);
+        free(queue);
+        return false;
+    }
+
+    // the trie; 0 means no edge, as no edge leads back to the root
+    size_t num_states = 1;
+    for (size_t i = 0; i < count; i++){
+        uint32_t state = 0;
+        for (size_t j = 0; j < lengths[i]; j++){
+            uint32_t *edge = &transitions[state * num_classes + matcher->classes[(unsigned char)patterns[i][j]]];
+            if (!*edge){
+                *edge = (uint32_t)num_states++;
+            }
+            state = *edge;
+        }
+        if (!outputs[state]){
+            outputs[state] = (uint32_t)i + 1;   // of duplicate patterns, the first one is reported
+        }
+        pattern_lengths[i] = lengths[i];
+    }
+
+    /* Breadth first, so a state's failure state (its longest proper suffix
+       in the trie) is complete before the state itself: a missing edge
+       becomes the failure state's edge, and a state with no pattern of its
+       own reports the longest one that ends in its failure state.
+    */
+    size_t head = 0, tail = 0;
+    for (size_t c = 0; c < num_classes; c++){
+        uint32_t child = transitions[c];
+        if (child){
+            fail[child] = 0;
+            queue[tail++] = child;
+        }
+    }
+    while (head < tail){
+        uint32_t state = queue[head++];
+        uint32_t *row = &transitions[state * num_classes];
+        const uint32_t *fail_row = &transitions[fail[state] * num_classes];
+        for (size_t c = 0; c < num_classes; c++){
+            uint32_t child = row[c];
+            if (child){
+                fail[child] = fail_row[c];
+                if (!outputs[child]){
+                    outputs[child] = outputs[fail[child]];
+                }
+                queue[tail++] = child;
+            }
+            else{
+                row[c] = fail_row[c];
+            }
+        }
+    }
+    free(fail);
+    free(queue);
+
+    // state numbers to row offsets, flagging the states that report a match
+    for (size_t i = 0; i < num_states * num_classes; i++){
+        uint32_t target = transitions[i];
+        transitions[i] = (uint32_t)(target * num_classes) | (outputs[target] ? MATCHER_OUTPUT : 0);
+    }
+
+    matcher->transitions = transitions;
+    matcher->outputs = outputs;
+    matcher->lengths = pattern_lengths;
+    matcher->num_patterns = count;
+    matcher->num_states = num_states;
+
+    // what the start state can scan for
+    bool pairs = true;
+    for (size_t i = 0; i < count; i++){
+        unsigned char c = patterns[i][0];
+        if (!(matcher->start_map[c >> 3] & (1u << (c & 7)))){
+            matcher->start_map[c >> 3] |= 1u << (c & 7);
+            if (matcher->num_start_bytes < STR_TOK_SIMD_SET_MAX){
+                matcher->start_bytes[matcher->num_start_bytes] = (char)c;
+            }
+            matcher->num_start_bytes++;
+        }
+        if (lengths[i] < 2){
+            pairs = false;
+            continue;
+        }
+        size_t k = 0;
+        while (k < matcher->num_start_pairs && k < STR_TOK_SIMD_SET_MAX
+               && (matcher->pair_firsts[k] != patterns[i][0] || matcher->pair_seconds[k] != patterns[i][1])){
+            k++;
+        }
+        if (k == matcher->num_start_pairs){
+            if (k < STR_TOK_SIMD_SET_MAX){
+                matcher->pair_firsts[k] = patterns[i][0];
+                matcher->pair_seconds[k] = patterns[i][1];
+            }
+            matcher->num_start_pairs++;
+        }
+    }
+    if (pairs && matcher->num_start_pairs <= STR_TOK_SIMD_SET_MAX){
+        matcher->skip = STR_SKIP_PAIRS;
+    }
+    else if (matcher->num_start_bytes <= STR_TOK_SIMD_SET_MAX){
+        matcher->skip = STR_SKIP_BYTES;
+    }
+    else{
+        matcher->skip = STR_SKIP_NONE;
+    }
+    return true;
+}
+
+
+void str_matcher_free(StrMatcher *matcher){
+    free(matcher->transitions);
+    free(matcher->outputs);
+    free(matcher->lengths);
+    matcher->transitions = NULL;
+    matcher->outputs = NULL;
+    matcher->lengths = NULL;
+    matcher->num_patterns = 0;
+}
+
+
+bool str_matcher_find(const StrMatcher *matcher, const char text[], size_t length, StrMatch *match){
+    /* Find the first match in text: the one that ends first, and of the
+       patterns ending there, the longest. Fill in *match and return true,
+       or return false if no pattern occurs in text. To find every match,
+       call it again on the text after match->position.
+    */
+    const uint32_t *transitions = matcher->transitions;
+    const uint16_t *classes = matcher->classes;
+    const char *p = text, *end = text + length;
+    const char *resume_skipping = text;
+    uint32_t row = 0;
+
+    if (matcher->num_patterns == 0){
+        return false;
+    }
+    while (p < end){
+        if (row == 0 && matcher->skip != STR_SKIP_NONE && p >= resume_skipping){
+            const char *found = (matcher->skip == STR_SKIP_PAIRS)
+                ? find_pair_kernel(p, end, matcher->pair_firsts, matcher->pair_seconds, matcher->num_start_pairs)
+                : find_set_kernel(p, end, matcher->start_bytes, matcher->num_start_bytes, matcher->start_map);
+            if (found == end){
+                break;
+            }
+            if (found - p < MATCHER_MIN_SKIP){
+                resume_skipping = found + MATCHER_BACKOFF;
+            }
+            p = found;
+        }
+        uint32_t next = transitions[row + classes[(unsigned char)*p++]];
+        row = next & ~MATCHER_OUTPUT;
+        if (next & MATCHER_OUTPUT){
+            size_t pattern = matcher->outputs[row / matcher->num_classes] - 1;
+            match->pattern = pattern;
+            match->length = matcher->lengths[pattern];
+            match->position = (size_t)(p - text) - match->length;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+/*                              * * *
+   TOKENIZER
+
+   A StrTokenizer keeps all of its state in the struct the caller hands in,
+   so any number of buffers can be tokenized at once, from any thread.
+   It never writes to the input: each token comes back as a pointer into
+   the input plus a length, which means the input can be read-only, 
+   mmap'd, or not NUL-terminated at all.
+
+   Tokens are split exactly like str_tokenize splits them: every delimiter
+   ends a token, so two adjacent delimiters produce an empty token, and the 
+   text after the last delimiter (possibly empty) is always the last token.
+*/
+
+static void tokenizer_init(StrTokenizer *tokenizer, const char input[], size_t length){
+    tokenizer->input = input;
+    tokenizer->length = length;
+    tokenizer->position = 0;
+    tokenizer->done = false;
+}
+
+
+void str_tokenizer_init(StrTokenizer *tokenizer, const char input[], size_t length, char delimiter){
+    /* Split input on a single delimiter char */
+    tokenizer_init(tokenizer, input, length);
+    tokenizer->mode = STR_TOK_CHAR;
+    tokenizer->delimiter = delimiter;
+}
+
+
+void str_tokenizer_init_set(StrTokenizer *tokenizer, const char input[], size_t length,
+                            const char delimiters[], size_t num_delimiters){
+    /* Split input on any one of the num_delimiters chars in delimiters.
+       delimiters has to outlive the tokenizer.
+    */
+    tokenizer_init(tokenizer, input, length);
+    if (num_delimiters == 1){
+        tokenizer->mode = STR_TOK_CHAR;
+        tokenizer->delimiter = delimiters[0];
+        return;
+    }
+    tokenizer->mode = STR_TOK_SET;
+    tokenizer->delimiters = delimiters;
+    tokenizer->num_delimiters = num_delimiters;
+    memset(tokenizer->set_map, 0, sizeof(tokenizer->set_map));
+    for (size_t k = 0; k < num_delimiters; k++){
+        unsigned char c = delimiters[k];
+        tokenizer->set_map[c >> 3] |= 1u << (c & 7);
+    }
+}
+
+
+void str_tokenizer_init_seq(StrTokenizer *tokenizer, const char input[], size_t length,
+                            const char delimiter[], size_t delimiter_length){
+    /* Split input on the multi-char delimiter, e.g. ", " or "\r\n".
+       delimiter has to outlive the tokenizer. An empty delimiter
+       never matches, so the whole input is one token.
+    */
+    tokenizer_init(tokenizer, input, length);
+    tokenizer->mode = STR_TOK_SEQ;
+    tokenizer->delimiters = delimiter;
+    tokenizer->num_delimiters = delimiter_length;
+}
+
+
+void str_tokenizer_reset(StrTokenizer *tokenizer, const char input[], size_t length){
+    /* Point the tokenizer at new input, keeping its delimiters, so that
+       the set doesn't have to be built again for every buffer.
+    */
+    tokenizer_init(tokenizer, input, length);
+}
+
+
+static const char *tokenizer_find_seq(const StrTokenizer *tokenizer, const char *p, const char *end, size_t *skip){
+    /* Find the next occurrence of the delimiter sequence, with the substring search */
+    size_t delimiter_length = tokenizer->num_delimiters;
+
+    *skip = delimiter_length;
+    if (delimiter_length == 0){
+        return end;
+    }
+    const char *found = find_n(p, (size_t)(end - p), tokenizer->delimiters, delimiter_length);
+    return found ? found : end;
+}
+
+
+bool str_tokenizer_next(StrTokenizer *tokenizer, StrToken *token){
+    /* Store the next token in *token and return true, or return false
+       once the input is exhausted.
+    */
+    if (tokenizer->done){
+        return false;
+    }
+
+    const char *start = tokenizer->input + tokenizer->position;
+    const char *end = tokenizer->input + tokenizer->length;
+    const char *found;
+    size_t skip = 1;    // length of the delimiter that was found
+
+    switch (tokenizer->mode){
+        case STR_TOK_CHAR:
+            found = find_byte_kernel(start, end, tokenizer->delimiter);
+            break;
+        case STR_TOK_SET:
+            found = find_set_kernel(start, end, tokenizer->delimiters, tokenizer->num_delimiters, tokenizer->set_map);
+            break;
+        default:
+            found = tokenizer_find_seq(tokenizer, start, end, &skip);
+            break;
+    }
+
+    token->ptr = start;
+    token->length = found - start;
+    if (found == end){
+        tokenizer->done = true;     // no delimiter left, so this is the last token
+        tokenizer->position = tokenizer->length;
+    }
+    else{
+        tokenizer->position = (found - tokenizer->input) + skip;
+    }
+    return true;
+}
+
+
+
+char *str_tokenize(char string_arg[], char delimiter){
+    /* Return the next token in string_arg when called.
+
+       A token is a substring delimitated by delimiter.
+       e.g. 'my_name_is_x' has 4 tokens and 3 delimiters.
+
+       The initial call to the function has to specify the 
+       string to tokenize. After that, unless another string
+       needs to be tokenized, the function is called with NULL
+       as the first argument, to indicate that it should continue
+       tokenizing the same string.
+
+       The function maintains internal state by using static variables.
+       Since the whole input string is not tokenized at once, but bit by
+       bit with each call, this is a form of lazy evaluation.
+
+       This is kept for compatibility: it runs a StrTokenizer held in a 
+       static variable, and terminates each token by writing a NUL over
+       the delimiter that follows it. New code should use 
+       str_tokenizer_next(), which doesn't modify the input and can
+       have any number of tokenizations going at once.
+    */
+    static StrTokenizer tokenizer;
+    StrToken token;
+
+    // if string_arg is not NULL, (re) initialize the internal state
+    if (string_arg){
+        str_tokenizer_init(&tokenizer, string_arg, str_len(string_arg), delimiter);
+    }
+
+    if (!str_tokenizer_next(&tokenizer, &token)){
+        return NULL;
+    }
+    char *res = (char *)token.ptr;
+    res[token.length] = '\0';  // replace the delimiter with a NUL (the last token already ends in one)
+    return res;
+}
+
+
+
+
+/*                              * * *
+   INTEGER FORMATTING
+
+   Numbers are written right to left two digits at a time, looking each
+   pair up in digit_pairs, so there's one division per two digits instead
+   of one per digit. The output length is worked out up front from the
+   bit length of the number (log10(2) is about 1233/4096), corrected with
+   a single comparison against a power of ten, instead of by dividing
+   the number down.
+*/
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint64_t powers_of_10[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+
+static unsigned count_digits_u64(uint64_t u){
+    /* Number of decimal digits in u, counting 0 as one digit */
+    u |= 1;
+    unsigned approx = (bit_length64(u) * 1233) >> 12;   // floor(log10(u)) or one more than it
+    return approx + 1 - (u < powers_of_10[approx]);
+}
+
+
+static uint64_t magnitude_of(long num){
+    // unsigned negation, so that LONG_MIN doesn't overflow
+    return (num < 0) ? 0 - (uint64_t)num : (uint64_t)num;
+}
+
+
+static void write_digits(char *end, uint64_t u){
+    /* Write the digits of u so that the last one lands just before end */
+    while (u >= 100){
+        unsigned pair = (unsigned)(u % 100) * 2;
+        u /= 100;
+        end -= 2;
+        memcpy(end, digit_pairs + pair, 2);
+    }
+    if (u >= 10){
+        memcpy(end - 2, digit_pairs + u * 2, 2);
+    }
+    else{
+        end[-1] = '0' + (char)u;
+    }
+}
+
+
+static size_t format_long_length(long num){
+    return count_digits_u64(magnitude_of(num)) + (num < 0);
+}
+
+
+static size_t format_long_unterminated(char buf[], long num, size_t length){
+    /* Write num into buf[0..length), where length is format_long_length(num) */
+    if (num < 0){
+        buf[0] = '-';
+    }
+    write_digits(buf + length, magnitude_of(num));
+    return length;
+}
+
+
+size_t str_format_long(char buf[], long num){
+    /* Write the decimal representation of num into buf, NUL-terminated,
+       and return its length (not counting the NUL). buf must have room for
+       STR_FORMAT_LONG_MAX chars. Nothing is allocated.
+    */
+    size_t length = format_long_unterminated(buf, num, format_long_length(num));
+    buf[length] = '\0';
+    return length;
+}
+
+
+size_t str_format_longs(char buf[], size_t buf_size, const long values[], size_t count,
+                        char delimiter, size_t *formatted){
+    /* Format count values into buf, one after another with delimiter
+       between them, e.g. "12,-7,300", and NUL-terminate the result.
+       Return the length of what was written, not counting the NUL.
+
+       If buf_size isn't enough for all of them, stop before the first
+       value that doesn't fit (along with its delimiter and the NUL), so
+       buf never holds a partial number. *formatted, if not NULL, gets how
+       many values were written; the rest can be formatted into the next
+       buffer starting at values + *formatted. count * STR_FORMAT_LONG_MAX
+       chars is always enough.
+    */
+    size_t position = 0;
+    size_t i = 0;
+
+    if (buf_size == 0){
+        if (formatted){
+            *formatted = 0;
+        }
+        return 0;
+    }
+    for (; i < count; i++){
+        size_t length = format_long_length(values[i]);
+        size_t needed = length + (i > 0) + 1;   // the delimiter before it, and the NUL after it
+        if (buf_size - position < needed){
+            break;
+        }
+        if (i > 0){
+            buf[position++] = delimiter;
+        }
+        position += format_long_unterminated(buf + position, values[i], length);
+    }
+    buf[position] = '\0';
+    if (formatted){
+        *formatted = i;
+    }
+    return position;
+}
+
+
+unsigned short str_count_digits(long num){
+    /* Count digits in num. 0 has no digits, as far as this is concerned */
+    if (num == 0){
+        return 0;
+    }
+    return count_digits_u64(magnitude_of(num));
+}
+
+
+char *str_from_int(long num){
+    /* Convert num to "num", in a malloc'ed char array that the caller
+       has to free. Return NULL if the memory can't be allocated.
+       str_format_long() does the same without allocating.
+    */
+    size_t length = format_long_length(num);
+    char *res = malloc(length + 1);
+    INSTR_COUNT(INSTR_STR_FROM_INT_ALLOCS, 1);
+    if (!res){
+        return NULL;
+    }
+    format_long_unterminated(res, num, length);
+    res[length] = '\0';     // NUL-terminate the string
+    return res;
+}
+
+
+char *str_from_int_arena(long num, Arena *arena){
+    /* str_from_int(), in memory from arena. Return NULL if the arena can't grow */
+    size_t length = format_long_length(num);
+    char *res = arena_alloc_aligned(arena, length + 1, 1);
+    if (!res){
+        return NULL;
+    }
+    format_long_unterminated(res, num, length);
+    res[length] = '\0';
+    return res;
+}
+
+
+char *str_dup_arena(const char buf[], size_t length, Arena *arena){
+    char *res = arena_alloc_aligned(arena, length + 1, 1);
+    if (!res){
+        return NULL;
+    }
+    memcpy(res, buf, length);
+    res[length] = '\0';
+    return res;
+}
+
+
+long str_copy(char str1[], char str2[]){
+    /* Copy the contents of str2 into str1 until NULL is encountered.
+
+       Return -1 if any of the strings are NULL (and thus invalid input),
+       or else the value of the index when the copying is done, i.e.
+       where in str1 the process finished.
+
+       This might be useful for knowing exactly where to terminate str1
+       or/and knowing where to continue copying from another string.
+
+       For example, if str1 is 25 chars long and str2 is 10 chars long,
+       str_copy will copy everything in str2 into str1 (10 chars),
+       and then it will stop, because it ran into NUL, the string 
+       terminatior for str2.
+       Str_copy does not terminate str1. Instead, it will return 
+       the value 11, in this case. 
+       The caller can then either insert NULL here and terminate str1
+       ( str1[the_return_value_of_str_copy] = '\0'), or call
+       str_copy with str1 again, and another string.
+       Str_copy will then start copying from str2 and inserting
+       the read items into str1 starting at str1[11].
+    */
+    if (str1 == NULL || str2 == NULL){
+        return -1;
+    }
+    return copy_kernel(str1, str2);
+}
+
+
+
+unsigned short str_compare(char str1[], char str2[]){
+    /* Compare str1 and str2 in a single pass. The scan stops at the first
+       position where the strings differ or at str1's NUL, whichever comes
+       first, so neither string is ever measured with str_len.
+    */
+    return compare_kernel(str1, str2);
+}
+
+
+
+bool str_is_same(char str1[], char str2[]){
+    /* The compare kernel already stops at the first difference or at the
+       NUL, so equality is one pass over the shorter string
+    */
+    return compare_kernel(str1, str2) == 1;
+}
+
+
+
+
+
+
+
+
+unsigned short str_compare_n(const char str1[], size_t length1, const char str2[], size_t length2){
+    /* Same ordering as str_compare, for strings whose lengths are already
+       known. The chars are compared a word at a time up to the first word
+       that differs; the lengths only decide the result when one string
+       is a prefix of the other.
+    */
+    size_t iterations = (length1 < length2) ? length1 : length2;
+    size_t i = 0;
+    uint64_t w1, w2;
+
+    for (; i + sizeof(uint64_t) <= iterations; i += sizeof(uint64_t)){
+        memcpy(&w1, str1 + i, sizeof(w1));
+        memcpy(&w2, str2 + i, sizeof(w2));
+        if (w1 != w2){
+            break;
+        }
+    }
+    for (; i < iterations; i++){
+        if (str1[i] < str2[i]){
+            return 2;
+        }
+        else if (str1[i] > str2[i]){
+            return 0;
+        }
+    }
+    if (length1 < length2){
+        return 2;
+    }
+    else if (length1 > length2){
+        return 0;
+    }
+    return 1;
+}
+
+
+static bool equal_n(const char *s1, const char *s2, size_t length){
+    /* s1[0..length) == s2[0..length). Keys are mostly short, so those are
+       done inline a word at a time, with the last word overlapping the one
+       before it instead of a byte loop for the tail. Long ones go to memcmp,
+       which libc vectorizes.
+    */
+    uint64_t w1, w2;
+    uint32_t h1, h2, t1, t2;
+
+    if (length >= sizeof(uint64_t)){
+        if (length > 64){
+            return memcmp(s1, s2, length) == 0;
+        }
+        for (size_t i = 0; i + sizeof(uint64_t) < length; i += sizeof(uint64_t)){
+            memcpy(&w1, s1 + i, sizeof(w1));
+            memcpy(&w2, s2 + i, sizeof(w2));
+            if (w1 != w2){
+                return false;
+            }
+        }
+        memcpy(&w1, s1 + length - sizeof(uint64_t), sizeof(w1));
+        memcpy(&w2, s2 + length - sizeof(uint64_t), sizeof(w2));
+        return w1 == w2;
+    }
+    if (length >= sizeof(uint32_t)){
+        // two 4-byte halves, overlapping when length < 8
+        memcpy(&h1, s1, sizeof(h1));
+        memcpy(&h2, s2, sizeof(h2));
+        memcpy(&t1, s1 + length - sizeof(uint32_t), sizeof(t1));
+        memcpy(&t2, s2 + length - sizeof(uint32_t), sizeof(t2));
+        return ((h1 ^ h2) | (t1 ^ t2)) == 0;
+    }
+    if (length == 0){
+        return true;
+    }
+    // 1 to 3 chars: the first, middle and last one cover them all
+    return s1[0] == s2[0] && s1[length / 2] == s2[length / 2] && s1[length - 1] == s2[length - 1];
+}
+
+
+bool str_is_same_n(const char str1[], size_t length1, const char str2[], size_t length2){
+    /* Equality only: strings of different lengths are rejected without looking at them */
+    return length1 == length2 && equal_n(str1, str2, length1);
+}
+
+
+size_t str_copy_n(char str1[], const char str2[], size_t length){
+    /* Counted str_copy: copy length chars of str2 into str1 and return
+       the index in str1 where copying stopped. str1 isn't terminated.
+    */
+    memcpy(str1, str2, length);
+    return length;
+}
+
+
+
+/*                              * * *
+   KEYS
+
+   str_hash_n is wyhash (final version 4, public domain, by Wang Yi):
+   the input is consumed 16 bytes per 64x64->128 bit multiply, and keys
+   of 48 bytes or more in three independent 16-byte lanes, so the multiplies
+   of consecutive stripes overlap in the pipeline instead of waiting on
+   each other. Keys of up to 16 bytes take no loop at all. Words are read
+   little-endian on every platform so a hash can be stored or sent elsewhere.
+*/
+
+static const uint64_t hash_secret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+
+static void hash_mum(uint64_t *a, uint64_t *b){
+    /* The full 128-bit product of *a and *b, low half in *a, high half in *b */
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = (unsigned __int128)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), carry = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    carry += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+}
+
+
+static uint64_t hash_mix(uint64_t a, uint64_t b){
+    hash_mum(&a, &b);
+    return a ^ b;
+}
+
+
+static inline uint64_t hash_read8(const unsigned char *p, bool fold){
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    if (fold){
+        w = flip_case_word(w, 'A');
+    }
+#if !STR_SWAR_LE
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
+
+static inline uint64_t hash_read4(const unsigned char *p, bool fold){
+    uint32_t w;
+    memcpy(&w, p, sizeof(w));
+    if (fold){
+        w = (uint32_t)flip_case_word(w, 'A');
+    }
+#if !STR_SWAR_LE
+    w = __builtin_bswap32(w);
+#endif
+    return w;
+}
+
+
+static STR_ALWAYS_INLINE uint64_t hash_core(const char buf[], size_t length, uint64_t seed, bool fold){
+    /* Hash buf[0..length), or with fold, as if its ASCII letters were
+       lowercased. Each word is folded as it's read, which costs a few ALU
+       ops per 8 bytes and no copy.
+    */
+    const unsigned char *p = (const unsigned char *)buf;
+    uint64_t a, b;
+
+    seed ^= hash_mix(seed ^ hash_secret[0], hash_secret[1]);
+    if (length <= 16){
+        if (length >= 4){
+            // two overlapping 8-byte samples made of 4-byte reads from both ends
+            size_t middle = (length >> 3) << 2;
+            a = (hash_read4(p, fold) << 32) | hash_read4(p + middle, fold);
+            b = (hash_read4(p + length - 4, fold) << 32) | hash_read4(p + length - 4 - middle, fold);
+        }
+        else if (length > 0){
+            unsigned char c0 = p[0], c1 = p[length >> 1], c2 = p[length - 1];
+            if (fold){
+                c0 = fold_char(c0);
+                c1 = fold_char(c1);
+                c2 = fold_char(c2);
+            }
+            a = ((uint64_t)c0 << 16) | ((uint64_t)c1 << 8) | c2;
+            b = 0;
+        }
+        else{
+            a = b = 0;
+        }
+    }
+    else{
+        size_t i = length;
+        if (i >= 48){
+            uint64_t see1 = seed, see2 = seed;
+            do{
+                seed = hash_mix(hash_read8(p, fold) ^ hash_secret[1], hash_read8(p + 8, fold) ^ seed);
+                see1 = hash_mix(hash_read8(p + 16, fold) ^ hash_secret[2], hash_read8(p + 24, fold) ^ see1);
+                see2 = hash_mix(hash_read8(p + 32, fold) ^ hash_secret[3], hash_read8(p + 40, fold) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16){
+            seed = hash_mix(hash_read8(p, fold) ^ hash_secret[1], hash_read8(p + 8, fold) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // the last 16 bytes, overlapping what came before
+        a = hash_read8(p + i - 16, fold);
+        b = hash_read8(p + i - 8, fold);
+    }
+    a ^= hash_secret[1];
+    b ^= seed;
+    hash_mum(&a, &b);
+    return hash_mix(a ^ hash_secret[0] ^ length, b ^ hash_secret[1]);
+}
+
+
+uint64_t str_hash_n(const char buf[], size_t length, uint64_t seed){
+    /* Hash buf[0..length) */
+    INSTR_RECORD(INSTR_STR_HASH_LEN, length);
+    return hash_core(buf, length, seed, false);
+}
+
+
+uint64_t str_hash(char string_arg[], uint64_t seed){
+    return str_hash_n(string_arg, len_kernel(string_arg), seed);
+}
+
+
+void str_hash_many(const char *const keys[], const size_t lengths[], size_t count,
+                   uint64_t seed, uint64_t hashes[]){
+    /* hashes[i] = str_hash_n(keys[i], lengths[i], seed), one key after
+       another. Nothing is shared between the keys' hashes; the only help
+       over calling str_hash_n() directly is that the keys a few places
+       ahead are prefetched, so a batch scattered over memory doesn't stall
+       on each one in turn.
+    */
+    enum{PREFETCH_DISTANCE = 4};
+
+    for (size_t i = 0; i < count; i++){
+#if defined(__GNUC__) || defined(__clang__)
+        if (i + PREFETCH_DISTANCE < count){
+            __builtin_prefetch(keys[i + PREFETCH_DISTANCE]);
+        }
+#endif
+        hashes[i] = str_hash_n(keys[i], lengths[i], seed);
+    }
+}
+
+
+bool str_has_prefix(char string_arg[], char prefix[]){
+    /* True if string_arg starts with prefix. Only as much of string_arg is
+       read as prefix is long, so it doesn't need to be measured first.
+    */
+    size_t i = 0;
+    while (prefix[i] != '\0'){
+        if (string_arg[i] != prefix[i]){
+            return false;
+        }
+        i++;
+    }
+    return true;
+}
+
+
+bool str_has_prefix_n(const char string_arg[], size_t length, const char prefix[], size_t prefix_length){
+    return prefix_length <= length && equal_n(string_arg, prefix, prefix_length);
+}
+
+
+size_t str_common_prefix_n(const char str1[], size_t length1, const char str2[], size_t length2){
+    /* The number of leading chars str1 and str2 have in common. Whole words
+       are compared, and the first differing byte in a word is found from
+       the lowest set bit of their XOR.
+    */
+    size_t limit = (length1 < length2) ? length1 : length2;
+    size_t i = 0;
+    uint64_t w1, w2;
+
+    for (; i + sizeof(uint64_t) <= limit; i += sizeof(uint64_t)){
+        memcpy(&w1, str1 + i, sizeof(w1));
+        memcpy(&w2, str2 + i, sizeof(w2));
+        if (w1 != w2){
+#if STR_SWAR_LE
+            return i + bit_ctz64(w1 ^ w2) / 8;
+#else
+            break;
+#endif
+        }
+    }
+    while (i < limit && str1[i] == str2[i]){
+        i++;
+    }
+    return i;
+}
+
+
+
+/*                              * * *
+   CASE FOLDING
+
+   ASCII only, on purpose: the result doesn't depend on the locale, and
+   bytes from 0x80 up (including every byte of a UTF-8 multi-byte char)
+   are left alone. The case-insensitive compare and hash fold both sides
+   as they go, a word or vector at a time, instead of lowercasing copies
+   first, so they cost about what their case-sensitive versions do.
+*/
+
+void str_to_lower_n(const char src[], size_t length, char dst[]){
+    /* Write src[0..length) lowercased to dst and NUL-terminate it. dst can be src */
+    case_kernel(dst, src, length, 'A');
+    dst[length] = '\0';
+}
+
+
+void str_to_upper_n(const char src[], size_t length, char dst[]){
+    case_kernel(dst, src, length, 'a');
+    dst[length] = '\0';
+}
+
+
+void str_to_lower_ip_n(char string_arg[], size_t length){
+    case_kernel(string_arg, string_arg, length, 'A');
+}
+
+
+void str_to_upper_ip_n(char string_arg[], size_t length){
+    case_kernel(string_arg, string_arg, length, 'a');
+}
+
+
+void str_to_lower(char src[], char dst[]){
+    str_to_lower_n(src, len_kernel(src), dst);
+}
+
+
+void str_to_upper(char src[], char dst[]){
+    str_to_upper_n(src, len_kernel(src), dst);
+}
+
+
+void str_to_lower_ip(char string_arg[]){
+    str_to_lower_ip_n(string_arg, len_kernel(string_arg));
+}
+
+
+void str_to_upper_ip(char string_arg[]){
+    str_to_upper_ip_n(string_arg, len_kernel(string_arg));
+}
+
+
+unsigned short str_compare_nocase_n(const char str1[], size_t length1, const char str2[], size_t length2){
+    /* str_compare_n's ordering, with both strings lowercased: "Apple" and
+       "apple" are equal, and "apple" < "Banana"
+    */
+    size_t limit = (length1 < length2) ? length1 : length2;
+    size_t i = mismatch_nocase_kernel(str1, str2, limit);
+
+    if (i < limit){
+        char c1 = (char)fold_char(str1[i]);
+        char c2 = (char)fold_char(str2[i]);
+        return (c1 < c2) ? 2 : 0;
+    }
+    if (length1 < length2){
+        return 2;
+    }
+    else if (length1 > length2){
+        return 0;
+    }
+    return 1;
+}
+
+
+unsigned short str_compare_nocase(char str1[], char str2[]){
+    return str_compare_nocase_n(str1, len_kernel(str1), str2, len_kernel(str2));
+}
+
+
+bool str_is_same_nocase_n(const char str1[], size_t length1, const char str2[], size_t length2){
+    return length1 == length2 && mismatch_nocase_kernel(str1, str2, length1) == length1;
+}
+
+
+bool str_is_same_nocase(char str1[], char str2[]){
+    // measure both first: the kernel reads whole blocks, which mustn't run past a shorter str2
+    return str_is_same_nocase_n(str1, len_kernel(str1), str2, len_kernel(str2));
+}
+
+
+uint64_t str_hash_nocase_n(const char buf[], size_t length, uint64_t seed){
+    /* Equal to str_hash_n() of buf lowercased, so it goes with
+       str_is_same_nocase_n() in a case-insensitive hash table
+    */
+    INSTR_RECORD(INSTR_STR_HASH_LEN, length);
+    return hash_core(buf, length, seed, true);
+}
+
+
+uint64_t str_hash_nocase(char string_arg[], uint64_t seed){
+    return str_hash_nocase_n(string_arg, len_kernel(string_arg), seed);
+}
+
+
+
+/*                              * * *
+   PSTRING
+
+   A PString carries its length and capacity, so none of the pstr_ functions
+   have to scan for the NUL. The contents are still kept NUL-terminated, so
+   pstr_data() can be handed to anything that takes a char[].
+
+   Strings of up to PSTR_INLINE_CAP chars live inside the struct itself
+   (buf.small) and never touch malloc. Longer ones are moved to the heap
+   (buf.heap), and from then on the capacity only grows, doubling each time,
+   so appending is amortized O(1). A PString that's on the heap stays there
+   until pstr_free().
+*/
+
+#define PSTR_IS_INLINE(pstr) ((pstr)->capacity <= PSTR_INLINE_CAP)
+
+
+void pstr_init(PString *pstr){
+    /* Initialize pstr to the empty string, using the inline buffer */
+    pstr->length = 0;
+    pstr->capacity = PSTR_INLINE_CAP;
+    pstr->buf.small[0] = '\0';
+}
+
+
+void pstr_free(PString *pstr){
+    /* Release pstr's heap buffer, if it has one, and leave it empty */
+    if (!PSTR_IS_INLINE(pstr)){
+        free(pstr->buf.heap);
+    }
+    pstr_init(pstr);
+}
+
+
+bool pstr_reserve(PString *pstr, size_t capacity){
+    /* Make sure pstr can hold capacity chars (plus the NUL) without
+       reallocating. Return false if the memory can't be allocated,
+       in which case pstr is left untouched.
+    */
+    if (capacity <= pstr->capacity){
+        return true;
+    }
+
+    size_t new_capacity = pstr->capacity * 2;
+    if (new_capacity < capacity){
+        new_capacity = capacity;
+    }
+
+    char *new_buf;
+    INSTR_COUNT(INSTR_PSTR_ALLOCS, 1);
+    if (PSTR_IS_INLINE(pstr)){
+        new_buf = malloc(new_capacity + 1);
+        if (!new_buf){
+            return false;
+        }
+        memcpy(new_buf, pstr->buf.small, pstr->length + 1);
+    }
+    else{
+        new_buf = realloc(pstr->buf.heap, new_capacity + 1);
+        if (!new_buf){
+            return false;
+        }
+    }
+    pstr->buf.heap = new_buf;
+    pstr->capacity = new_capacity;
+    return true;
+}
+
+
+bool pstr_assign(PString *pstr, const char buf[], size_t length){
+    /* Replace the contents of pstr with the length chars in buf */
+    if (!pstr_reserve(pstr, length)){
+        return false;
+    }
+    char *data = pstr_data(pstr);
+    memmove(data, buf, length);
+    data[length] = '\0';
+    pstr->length = length;
+    return true;
+}
+
+
+bool pstr_from_cstr(PString *pstr, const char string_arg[]){
+    /* Initialize pstr with a copy of the NUL-terminated string_arg */
+    pstr_init(pstr);
+    return pstr_assign(pstr, string_arg, str_len((char *)string_arg));
+}
+
+
+bool pstr_append_n(PString *pstr, const char buf[], size_t length){
+    /* Append the length chars in buf to pstr */
+    if (!pstr_reserve(pstr, pstr->length + length)){
+        return false;
+    }
+    char *data = pstr_data(pstr);
+    memcpy(data + pstr->length, buf, length);
+    pstr->length += length;
+    data[pstr->length] = '\0';
+    return true;
+}
+
+
+bool pstr_append(PString *dst, const PString *src){
+    /* Append src to dst -- the counted counterpart of chaining str_copy calls.
+       dst and src can be the same PString: its chars are only read after
+       pstr_reserve() has moved them, from wherever they ended up.
+    */
+    if (dst == src){
+        size_t length = dst->length;
+        if (!pstr_reserve(dst, 2 * length)){
+            return false;
+        }
+        char *data = pstr_data(dst);
+        memcpy(data + length, data, length);
+        dst->length = 2 * length;
+        data[dst->length] = '\0';
+        return true;
+    }
+    return pstr_append_n(dst, pstr_cdata(src), src->length);
+}
+
+
+bool pstr_copy(PString *dst, const PString *src){
+    /* Make dst a copy of src */
+    if (dst == src){
+        return true;
+    }
+    return pstr_assign(dst, pstr_cdata(src), src->length);
+}
+
+
+void pstr_rev_ip(PString *pstr){
+    str_rev_ip_n(pstr_data(pstr), pstr->length);
+}
+
+
+bool pstr_rev(const PString *src, PString *dst){
+    /* Store src reversed in dst. src and dst must be different PStrings */
+    if (!pstr_reserve(dst, src->length)){
+        return false;
+    }
+    str_rev_n(pstr_cdata(src), src->length, pstr_data(dst));
+    dst->length = src->length;
+    return true;
+}
+
+
+long pstr_to_int(const PString *pstr){
+    return str_to_int_n(pstr_cdata(pstr), pstr->length);
+}
+
+
+bool pstr_from_int(PString *pstr, long num){
+    /* Replace the contents of pstr with the decimal representation of num */
+    char digits[STR_FORMAT_LONG_MAX];
+    return pstr_assign(pstr, digits, str_format_long(digits, num));
+}
+
+
+unsigned short pstr_compare(const PString *pstr1, const PString *pstr2){
+    /* Same return values as str_compare */
+    return str_compare_n(pstr_cdata(pstr1), pstr1->length, pstr_cdata(pstr2), pstr2->length);
+}
+
+
+bool pstr_is_same(const PString *pstr1, const PString *pstr2){
+    return str_is_same_n(pstr_cdata(pstr1), pstr1->length, pstr_cdata(pstr2), pstr2->length);
+}
+
+
+uint64_t pstr_hash(const PString *pstr, uint64_t seed){
+    return str_hash_n(pstr_cdata(pstr), pstr->length, seed);
+}
+
+
+bool pstr_has_prefix(const PString *pstr, const PString *prefix){
+    return str_has_prefix_n(pstr_cdata(pstr), pstr->length, pstr_cdata(prefix), prefix->length);
+}
+
+
+
+/*                              * * *
+   STRING BUILDER
+
+   A StrBuilder is a heap buffer, a length and a capacity. The buffer is
+   allocated on the first append and from then on at least doubles each
+   time it grows, so n appended chars cost O(n) in copying all told. Only
+   the growing is out of line: every append first makes sure there's room
+   for all of its chars at once, then copies them in without any further
+   checks.
+*/
+
+#define STR_BUILDER_MIN_CAPACITY 63     // so the first allocation is 64 bytes
+
+
+void str_builder_init(StrBuilder *builder){
+    /* Initialize an empty builder. Nothing is allocated until the first append */
+    builder->data = NULL;
+    builder->length = 0;
+    builder->capacity = 0;
+}
+
+
+void str_builder_free(StrBuilder *builder){
+    free(builder->data);
+    str_builder_init(builder);
+}
+
+
+void str_builder_clear(StrBuilder *builder){
+    builder->length = 0;
+    if (builder->data){
+        builder->data[0] = '\0';
+    }
+}
+
+
+bool str_builder_grow(StrBuilder *builder, size_t additional){
+    /* Reallocate the buffer so that additional more chars fit, to at least
+       twice its capacity. Called by the appending functions when they've
+       run out of room.
+    */
+    if (additional > SIZE_MAX - 1 - builder->length){
+        return false;
+    }
+    size_t needed = builder->length + additional;
+    size_t new_capacity = (builder->capacity > (SIZE_MAX - 1) / 2) ? SIZE_MAX - 1 : builder->capacity * 2 + 1;
+
+    if (new_capacity < needed){
+        new_capacity = needed;
+    }
+    if (new_capacity < STR_BUILDER_MIN_CAPACITY){
+        new_capacity = STR_BUILDER_MIN_CAPACITY;
+    }
+    char *new_data = realloc(builder->data, new_capacity + 1);
+    INSTR_COUNT(INSTR_STR_BUILDER_ALLOCS, 1);
+    if (!new_data){
+        return false;
+    }
+    new_data[builder->length] = '\0';   // for a buffer that's just been allocated
+    builder->data = new_data;
+    builder->capacity = new_capacity;
+    return true;
+}
+
+
+bool str_builder_reserve(StrBuilder *builder, size_t additional){
+    /* Make sure additional more chars can be appended without reallocating */
+    if (additional <= builder->capacity - builder->length){
+        return true;
+    }
+    return str_builder_grow(builder, additional);
+}
+
+
+bool str_builder_append_n(StrBuilder *builder, const char buf[], size_t length){
+    /* Append the length chars in buf, which must not point into the builder */
+    if (!str_builder_reserve(builder, length)){
+        return false;
+    }
+    memcpy(builder->data + builder->length, buf, length);
+    builder->length += length;
+    builder->data[builder->length] = '\0';
+    return true;
+}
+
+
+bool str_builder_append(StrBuilder *builder, const char string_arg[]){
+    /* Append the NUL-terminated string_arg */
+    return str_builder_append_n(builder, string_arg, str_len((char *)string_arg));
+}
+
+
+bool str_builder_append_long(StrBuilder *builder, long num){
+    /* Append the decimal representation of num, formatted in place */
+    if (!str_builder_reserve(builder, STR_FORMAT_LONG_MAX - 1)){
+        return false;
+    }
+    builder->length += str_format_long(builder->data + builder->length, num);
+    return true;
+}
+
+
+bool str_builder_append_pieces(StrBuilder *builder, const StrPiece pieces[], size_t count){
+    /* Append count pieces one after another. The total is worked out
+       first, so the buffer grows at most once; if the pieces don't all
+       fit, none of them are appended.
+    */
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++){
+        if (pieces[i].length > SIZE_MAX - total){
+            return false;
+        }
+        total += pieces[i].length;
+    }
+    if (!str_builder_reserve(builder, total)){
+        return false;
+    }
+    char *p = builder->data + builder->length;
+    for (size_t i = 0; i < count; i++){
+        memcpy(p, pieces[i].ptr, pieces[i].length);
+        p += pieces[i].length;
+    }
+    builder->length += total;
+    builder->data[builder->length] = '\0';
+    return true;
+}
+
+
+bool str_builder_append_pstr(StrBuilder *builder, const PString *pstr){
+    return str_builder_append_n(builder, pstr_cdata(pstr), pstr->length);
+}
+
+
+char *str_builder_release(StrBuilder *builder, size_t *length){
+    /* Return the builder's NUL-terminated buffer, which the caller now
+       owns and has to free(), and leave the builder empty. *length, if
+       not NULL, gets the length of the string. Return NULL (keeping the
+       builder as it was) only if nothing had been allocated yet and the
+       empty string can't be.
+    */
+    char *data = builder->data;
+    if (!data){
+        data = malloc(1);
+        if (!data){
+            return NULL;
+        }
+        data[0] = '\0';
+    }
+    if (length){
+        *length = builder->length;
+    }
+    str_builder_init(builder);
+    return data;
+}
+
+
+bool str_builder_release_pstr(StrBuilder *builder, PString *pstr){
+    /* Replace the contents of pstr with the builder's, and leave the
+       builder empty. A buffer too big for the PString's inline storage
+       becomes its heap buffer as it is; a short one is copied inline.
+    */
+    if (builder->capacity <= PSTR_INLINE_CAP){
+        if (!pstr_assign(pstr, str_builder_data(builder), builder->length)){
+            return false;
+        }
+        str_builder_free(builder);
+        return true;
+    }
+    pstr_free(pstr);
+    pstr->buf.heap = builder->data;
+    pstr->length = builder->length;
+    pstr->capacity = builder->capacity;
+    str_builder_init(builder);
+    return true;
+}
@@ -1,21 +1,62 @@
+#ifndef PSTRINGS_H
+#define PSTRINGS_H
+
+
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "arena.h"
 
 void str_rev_ip(char string_arg[]);   // reverse string_arg in place
 void str_rev(char string_to_reverse[], char string_reversed[]);  // reverse string_arg and store the result in string_reversed
 
+// the same, reversing UTF-8 text by code point instead of by byte; invalid sequences are reversed byte by byte
+void str_rev_utf8_ip(char string_arg[]);
+void str_rev_utf8(char string_to_reverse[], char string_reversed[]);
+
 unsigned int str_len(char string_arg[]);  // return the length of string_arg, not counting the terminating Nul character
 
 // convert a string to an int, provided the string doesn't contain prohibited (non-numeric) characters
-long str_to_int(char string_arg[]);  
+long str_to_int(char string_arg[]);
+
+/* Checked integer parsing. str_parse_long() parses the number at the start
+   of a buffer and reports the value, how many chars it took up, and whether
+   it was valid; str_parse_longs() parses a whole delimited buffer into an
+   array in one call. See pstrings.c for the details of each error.
+*/
+typedef enum str_parse_error{
+    STR_PARSE_OK, STR_PARSE_EMPTY, STR_PARSE_BAD_CHAR, STR_PARSE_OVERFLOW
+} str_parse_err;
+
+str_parse_err str_parse_long(const char string_arg[], size_t length, long *value, size_t *consumed);
+size_t str_parse_longs(const char buf[], size_t length, char delimiter,
+                       long values[], size_t max_values, str_parse_err *error, size_t *consumed);
 
 // get a char array offering the ASCII representation of the digits in num
 char *str_from_int(long num);
 
+/* The same, allocated from arena instead of malloc'ed, so nothing has to
+   be freed one by one: the strings go away with arena_reset()/arena_free().
+   str_dup_arena() copies length chars of buf and NUL-terminates the copy.
+*/
+char *str_from_int_arena(long num, Arena *arena);
+char *str_dup_arena(const char buf[], size_t length, Arena *arena);
+
+/* Allocation-free formatting. str_format_long() writes num into a caller
+   buffer of at least STR_FORMAT_LONG_MAX chars and returns the length;
+   str_format_longs() writes a whole array as one delimited string.
+*/
+#define STR_FORMAT_LONG_MAX 21  // 19 digits of a 64-bit long, the sign and the NUL
+
+size_t str_format_long(char buf[], long num);
+size_t str_format_longs(char buf[], size_t buf_size, const long values[], size_t count,
+                        char delimiter, size_t *formatted);
+
 // count digits in num
 unsigned short str_count_digits(long num);
 
-// split string_arg into tokens and return a pointer to the next token on each call
+// split string_arg into tokens and return a pointer to the next token on each call.
+// Not reentrant, and overwrites the delimiters with NULs; see StrTokenizer below
 char *str_tokenize(char string_arg[], char delimiter);
 
 
@@ -70,5 +111,308 @@ unsigned short str_compare(char str1[], char str2[]);
 bool str_is_same(char str1[], char str2[]);
 
 
+/* ----- COUNTED VARIANTS -----
+ * These take the length of their string arguments instead of scanning
+ * for the NUL, and don't require the strings to be NUL-terminated.
+ * The char[] functions above that need a length call str_len once and
+ * then hand over to these.
+ */
+void str_rev_ip_n(char string_arg[], size_t length);
+void str_rev_n(const char string_to_reverse[], size_t length, char string_reversed[]);
+void str_rev_utf8_ip_n(char string_arg[], size_t length);
+void str_rev_utf8_n(const char string_to_reverse[], size_t length, char string_reversed[]);
+long str_to_int_n(const char string_arg[], size_t length);
+size_t str_copy_n(char str1[], const char str2[], size_t length);
+unsigned short str_compare_n(const char str1[], size_t length1, const char str2[], size_t length2);
+bool str_is_same_n(const char str1[], size_t length1, const char str2[], size_t length2);
+
+
+/* ----- KEYS -----
+ * Helpers for using strings as hash table keys. str_hash_n() is a 64-bit
+ * hash in the wyhash family: fast on short keys, good enough to index a
+ * table with the low bits directly, and the same on every platform for a
+ * given seed. str_hash_many() is only a convenience for hashing a batch
+ * of keys in one call: it's str_hash_n() in a loop, with the next keys
+ * prefetched, not a vectorized multi-key hash.
+ * The prefix functions answer "does it start with" without measuring or
+ * fully comparing either string.
+ */
+uint64_t str_hash_n(const char buf[], size_t length, uint64_t seed);
+uint64_t str_hash(char string_arg[], uint64_t seed);
+void str_hash_many(const char *const keys[], const size_t lengths[], size_t count,
+                   uint64_t seed, uint64_t hashes[]);
+
+bool str_has_prefix(char string_arg[], char prefix[]);
+bool str_has_prefix_n(const char string_arg[], size_t length, const char prefix[], size_t prefix_length);
+size_t str_common_prefix_n(const char str1[], size_t length1, const char str2[], size_t length2);
+
+
+
+/* ----- CASE FOLDING -----
+ * ASCII case conversion and case-insensitive comparison, the same in
+ * every locale; bytes from 0x80 up are never changed. The _ip functions
+ * convert in place, the others write to dst and NUL-terminate it (dst
+ * can be the same array as src). The compare, equality and hash
+ * functions treat 'A' and 'a' as equal without converting anything
+ * first, and str_hash_nocase_n(s) == str_hash_n(s lowercased), so they
+ * can key a case-insensitive hash table.
+ */
+void str_to_lower_ip(char string_arg[]);
+void str_to_upper_ip(char string_arg[]);
+void str_to_lower(char src[], char dst[]);
+void str_to_upper(char src[], char dst[]);
+void str_to_lower_ip_n(char string_arg[], size_t length);
+void str_to_upper_ip_n(char string_arg[], size_t length);
+void str_to_lower_n(const char src[], size_t length, char dst[]);
+void str_to_upper_n(const char src[], size_t length, char dst[]);
+
+unsigned short str_compare_nocase(char str1[], char str2[]);    // same return values as str_compare
+bool str_is_same_nocase(char str1[], char str2[]);
+unsigned short str_compare_nocase_n(const char str1[], size_t length1, const char str2[], size_t length2);
+bool str_is_same_nocase_n(const char str1[], size_t length1, const char str2[], size_t length2);
+uint64_t str_hash_nocase(char string_arg[], uint64_t seed);
+uint64_t str_hash_nocase_n(const char buf[], size_t length, uint64_t seed);
+
+
+/* ----- PSTRING -----
+ * A string that knows its own length and capacity. The contents are
+ * always NUL-terminated, so pstr_data() can be passed to the char[]
+ * functions as well. Strings of up to PSTR_INLINE_CAP chars are stored
+ * inside the struct and don't allocate.
+ *
+ * A PString must be set up with pstr_init() or pstr_from_cstr() and 
+ * released with pstr_free(). The functions that can allocate return
+ * false if malloc fails, leaving the PString as it was.
+ * Buffers passed to pstr_assign()/pstr_append_n() must not point into
+ * the PString being modified; pstr_append(&s, &s) and pstr_copy(&s, &s)
+ * are fine.
+ */
+#define PSTR_INLINE_CAP 23
+
+typedef struct pstring PString;
+
+struct pstring{
+    size_t length;      // not counting the terminating NUL
+    size_t capacity;    // chars that fit without reallocating, not counting the NUL
+    union{
+        char *heap;                         // capacity > PSTR_INLINE_CAP
+        char small[PSTR_INLINE_CAP + 1];    // capacity == PSTR_INLINE_CAP
+    } buf;
+};
+
+static inline char *pstr_data(PString *pstr){
+    return (pstr->capacity > PSTR_INLINE_CAP) ? pstr->buf.heap : pstr->buf.small;
+}
+
+static inline const char *pstr_cdata(const PString *pstr){
+    return (pstr->capacity > PSTR_INLINE_CAP) ? pstr->buf.heap : pstr->buf.small;
+}
+
+static inline size_t pstr_len(const PString *pstr){
+    return pstr->length;
+}
+
+void pstr_init(PString *pstr);
+void pstr_free(PString *pstr);
+bool pstr_reserve(PString *pstr, size_t capacity);
+bool pstr_assign(PString *pstr, const char buf[], size_t length);
+bool pstr_from_cstr(PString *pstr, const char string_arg[]);
+bool pstr_append_n(PString *pstr, const char buf[], size_t length);
+bool pstr_append(PString *dst, const PString *src);
+bool pstr_copy(PString *dst, const PString *src);
+void pstr_rev_ip(PString *pstr);
+bool pstr_rev(const PString *src, PString *dst);
+long pstr_to_int(const PString *pstr);
+bool pstr_from_int(PString *pstr, long num);
+unsigned short pstr_compare(const PString *pstr1, const PString *pstr2);   // same return values as str_compare
+bool pstr_is_same(const PString *pstr1, const PString *pstr2);
+uint64_t pstr_hash(const PString *pstr, uint64_t seed);
+bool pstr_has_prefix(const PString *pstr, const PString *prefix);
+
+
+
+/* ----- STRING BUILDER -----
+ * For putting a string together piece by piece, without working out its
+ * size up front the way chained str_copy() calls need. A StrBuilder's
+ * buffer grows geometrically, so appending is amortized O(1), and the
+ * pieces are copied (or, for integers, formatted) straight into it with
+ * no temporary strings in between. When it's done, the buffer can be
+ * handed off as a malloc'ed char[] or a PString, without a copy:
+ *
+ *     StrBuilder builder;
+ *     str_builder_init(&builder);
+ *     str_builder_append(&builder, "id=");
+ *     str_builder_append_long(&builder, id);
+ *     str_builder_append_char(&builder, '\n');
+ *     char *line = str_builder_release(&builder, &line_length);   // free() it later
+ *
+ * str_builder_append_pieces() appends a whole array of pieces with one
+ * size check, like writev() does with an iovec array. The contents are
+ * always NUL-terminated. The appending functions return false if malloc
+ * fails, leaving the builder as it was.
+ */
+typedef struct str_builder StrBuilder;
+typedef struct str_piece StrPiece;
+
+struct str_builder{
+    char *data;         // NULL until something is appended
+    size_t length;      // not counting the terminating NUL
+    size_t capacity;    // chars that fit without reallocating, not counting the NUL
+};
+
+struct str_piece{
+    const char *ptr;
+    size_t length;
+};
+
+void str_builder_init(StrBuilder *builder);
+void str_builder_free(StrBuilder *builder);
+void str_builder_clear(StrBuilder *builder);   // make it empty, keeping the buffer
+bool str_builder_reserve(StrBuilder *builder, size_t additional);     // room for additional more chars
+bool str_builder_grow(StrBuilder *builder, size_t additional);        // for the inline functions below
+
+bool str_builder_append_n(StrBuilder *builder, const char buf[], size_t length);
+bool str_builder_append(StrBuilder *builder, const char string_arg[]);
+bool str_builder_append_long(StrBuilder *builder, long num);
+bool str_builder_append_pieces(StrBuilder *builder, const StrPiece pieces[], size_t count);
+bool str_builder_append_pstr(StrBuilder *builder, const PString *pstr);
+
+// hand the buffer off, leaving the builder empty; the caller owns the result (NULL if malloc fails)
+char *str_builder_release(StrBuilder *builder, size_t *length);
+bool str_builder_release_pstr(StrBuilder *builder, PString *pstr);     // pstr must be initialized
+
+static inline const char *str_builder_data(const StrBuilder *builder){
+    return builder->data ? builder->data : "";
+}
+
+static inline size_t str_builder_len(const StrBuilder *builder){
+    return builder->length;
+}
+
+static inline bool str_builder_append_char(StrBuilder *builder, char c){
+    if (builder->length == builder->capacity && !str_builder_grow(builder, 1)){
+        return false;
+    }
+    builder->data[builder->length++] = c;
+    builder->data[builder->length] = '\0';
+    return true;
+}
+
+
+
+/* ----- TOKENIZER -----
+ * A reentrant replacement for str_tokenize. All the state lives in a 
+ * caller-owned StrTokenizer, the input is never modified (it can be 
+ * read-only and doesn't need a NUL), and tokens come back as views into 
+ * the input. Delimiters can be a single char, any char out of a set, or a
+ * multi-char sequence. For example:
+ *
+ *     StrTokenizer tokenizer;
+ *     StrToken token;
+ *     str_tokenizer_init(&tokenizer, line, line_length, ',');
+ *     while (str_tokenizer_next(&tokenizer, &token)){
+ *         // token.ptr[0 .. token.length) is the next field
+ *     }
+ */
+#define STR_TOK_SIMD_SET_MAX 8  // sets up to this size are scanned with vector compares
+
+typedef enum str_tokenizer_mode{
+    STR_TOK_CHAR, STR_TOK_SET, STR_TOK_SEQ
+} str_tok_mode;
+
+typedef struct str_token StrToken;
+typedef struct str_tokenizer StrTokenizer;
+
+struct str_token{
+    const char *ptr;    // into the tokenizer's input; not NUL-terminated
+    size_t length;
+};
+
+struct str_tokenizer{
+    const char *input;
+    size_t length;
+    size_t position;        // where the next token starts
+    bool done;
+    str_tok_mode mode;
+    char delimiter;             // STR_TOK_CHAR
+    const char *delimiters;     // STR_TOK_SET: the set; STR_TOK_SEQ: the sequence
+    size_t num_delimiters;      // size of the set, or length of the sequence
+    uint8_t set_map[32];        // STR_TOK_SET: one bit per byte value
+};
+
+void str_tokenizer_init(StrTokenizer *tokenizer, const char input[], size_t length, char delimiter);
+void str_tokenizer_init_set(StrTokenizer *tokenizer, const char input[], size_t length,
+                            const char delimiters[], size_t num_delimiters);
+void str_tokenizer_init_seq(StrTokenizer *tokenizer, const char input[], size_t length,
+                            const char delimiter[], size_t delimiter_length);
+bool str_tokenizer_next(StrTokenizer *tokenizer, StrToken *token);
+// start over on new input, splitting it on the same delimiters
+void str_tokenizer_reset(StrTokenizer *tokenizer, const char input[], size_t length);
+
+
+
+/* ----- SEARCHING -----
+ * str_find() returns the first occurrence of needle in haystack (NULL if
+ * there's none), str_count_occurrences() counts the non-overlapping ones,
+ * and str_find_any() returns the first char that's one of the chars in
+ * set, like strpbrk. Searching takes time linear in the haystack, for
+ * any needle.
+ *
+ * To look for many patterns at once, e.g. a list of keywords in every
+ * line of a log, compile them into a StrMatcher once and run
+ * str_matcher_find() on each line:
+ *
+ *     StrMatcher matcher;
+ *     StrMatch match;
+ *     str_matcher_init(&matcher, keywords, keyword_lengths, num_keywords);
+ *     if (str_matcher_find(&matcher, line, line_length, &match)){
+ *         // keywords[match.pattern] is at line + match.position
+ *     }
+ *     str_matcher_free(&matcher);
+ *
+ * A StrMatcher isn't modified by matching, so threads can share one.
+ */
+char *str_find(char haystack[], char needle[]);
+char *str_find_any(char haystack[], char set[]);
+size_t str_count_occurrences(char haystack[], char needle[]);
+const char *str_find_n(const char haystack[], size_t length, const char needle[], size_t needle_length);
+const char *str_find_any_n(const char haystack[], size_t length, const char set[], size_t set_size);
+size_t str_count_occurrences_n(const char haystack[], size_t length, const char needle[], size_t needle_length);
+
+typedef enum str_matcher_skip{
+    STR_SKIP_NONE, STR_SKIP_BYTES, STR_SKIP_PAIRS
+} str_matcher_skip;
+
+typedef struct str_matcher StrMatcher;
+typedef struct str_match StrMatch;
+
+struct str_match{
+    size_t pattern;     // index into the patterns the matcher was built from
+    size_t position;    // where in the text it starts
+    size_t length;
+};
+
+struct str_matcher{
+    uint32_t *transitions;      // the automaton; see pstrings.c
+    uint32_t *outputs;          // per state: 1 + the pattern found on reaching it, or 0
+    size_t *lengths;            // of each pattern
+    size_t num_patterns;
+    size_t num_states;
+    size_t num_classes;
+    uint16_t classes[256];      // byte -> column in transitions; up to 257 of them
+    // what the start state scans ahead for
+    str_matcher_skip skip;
+    char start_bytes[STR_TOK_SIMD_SET_MAX];     // the first chars of the patterns, if that few
+    size_t num_start_bytes;
+    uint8_t start_map[32];
+    char pair_firsts[STR_TOK_SIMD_SET_MAX];     // their first two chars, if that few
+    char pair_seconds[STR_TOK_SIMD_SET_MAX];
+    size_t num_start_pairs;
+};
+
+bool str_matcher_init(StrMatcher *matcher, const char *const patterns[], const size_t lengths[], size_t count);
+void str_matcher_free(StrMatcher *matcher);
+bool str_matcher_find(const StrMatcher *matcher, const char text[], size_t length, StrMatch *match);
 
 
+#endif
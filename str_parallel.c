@@ -0,0 +1,471 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "str_parallel.h"
+
+
+/*                              * * *
+   POOL
+
+   A job is a number of chunks and a function that runs one of them.
+   Before the job is handed out, the chunks are split into one contiguous
+   share per thread, [next, end) in the thread's worker. A thread takes
+   chunks from its own share by incrementing next, and when that's past
+   end, goes round the other threads doing the same to their shares.
+   Taking a chunk is one atomic increment, whether it's the owner or a
+   thief doing it, and a counter that's already past end just means the
+   share is used up, so there's no other bookkeeping and no locking per
+   chunk. The mutex and the condition variables are only used to start a
+   job and to wait for the last thread to finish it, which also makes
+   everything one thread wrote visible to the caller.
+*/
+
+struct str_pool_job{
+    void (*run)(const StrPool_job *job, size_t chunk, StrPoolStats *stats);
+    size_t num_chunks;
+    void *context;
+};
+
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+static void pool_work(StrPool *pool, const StrPool_job *job, size_t thread){
+    /* Run chunks of job on this thread until there are none left in any share */
+    StrPoolStats *stats = &pool->workers[thread].stats;
+    double start = now_seconds();
+
+    for (size_t k = 0; k < pool->num_threads; k++){
+        StrPool_worker *share = &pool->workers[(thread + k) % pool->num_threads];
+        size_t chunk;
+        while ((chunk = atomic_fetch_add_explicit(&share->next, 1, memory_order_relaxed)) < share->end){
+            job->run(job, chunk, stats);
+            stats->chunks++;
+            stats->chunks_stolen += (k != 0);
+        }
+    }
+    stats->seconds += now_seconds() - start;
+}
+
+
+static void *pool_thread(void *arg){
+    /* What each of the pool's threads runs: wait for a job, work on it, repeat */
+    StrPool_worker *self = arg;
+    StrPool *pool = self->pool;
+    size_t thread = (size_t)(self - pool->workers);
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;){
+        while (pool->generation == seen && !pool->shutdown){
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->shutdown){
+            break;
+        }
+        seen = pool->generation;
+        const StrPool_job *job = pool->job;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool_work(pool, job, thread);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0){
+            pthread_cond_signal(&pool->finished);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+
+static void pool_run(StrPool *pool, const StrPool_job *job){
+    /* Share out the chunks of job, run it on every thread, and return once it's done */
+    size_t num_threads = pool->num_threads;
+
+    if (job->num_chunks < 2){
+        num_threads = 1;    // not worth waking anybody up
+    }
+    for (size_t t = 0; t < pool->num_threads; t++){
+        size_t first = (t < num_threads) ? t * job->num_chunks / num_threads : 0;
+        size_t end = (t < num_threads) ? (t + 1) * job->num_chunks / num_threads : 0;
+        atomic_store_explicit(&pool->workers[t].next, first, memory_order_relaxed);
+        pool->workers[t].end = end;
+    }
+    if (num_threads == 1){
+        pool_work(pool, job, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->running = pool->num_threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_work(pool, job, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0){
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+static void pool_reset_stats(StrPool *pool){
+    for (size_t t = 0; t < pool->num_threads; t++){
+        memset(&pool->workers[t].stats, 0, sizeof(StrPoolStats));
+    }
+}
+
+
+bool str_pool_init(StrPool *pool, size_t num_threads){
+    /* Set up a pool of num_threads threads, counting the one that will
+       make the calls, so num_threads - 1 are started. 0 means one per
+       online CPU. Return false if the threads can't be started or the
+       memory can't be allocated.
+    */
+    if (num_threads == 0){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (cpus > 0) ? (size_t)cpus : 1;
+    }
+    pool->workers = aligned_alloc(STR_POOL_CACHE_LINE, num_threads * sizeof(StrPool_worker));
+    pool->threads = (num_threads > 1) ? malloc((num_threads - 1) * sizeof(pthread_t)) : NULL;
+    if (!pool->workers || (num_threads > 1 && !pool->threads)){
+        free(pool->workers);
+        free(pool->threads);
+        return false;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    pool->generation = 0;
+    pool->running = 0;
+    pool->shutdown = false;
+    pool->job = NULL;
+    pool->num_threads = num_threads;
+    for (size_t t = 0; t < num_threads; t++){
+        atomic_init(&pool->workers[t].next, 0);
+        pool->workers[t].end = 0;
+        pool->workers[t].pool = pool;
+    }
+    pool_reset_stats(pool);
+
+    for (size_t t = 1; t < num_threads; t++){
+        if (pthread_create(&pool->threads[t - 1], NULL, pool_thread, &pool->workers[t]) != 0){
+            pool->num_threads = t;      // just the ones that did start, for str_pool_destroy to stop
+            str_pool_destroy(pool);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void str_pool_destroy(StrPool *pool){
+    /* Stop and join the threads, and free the pool */
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t t = 1; t < pool->num_threads; t++){
+        pthread_join(pool->threads[t - 1], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->finished);
+    free(pool->threads);
+    free(pool->workers);
+    pool->threads = NULL;
+    pool->workers = NULL;
+    pool->num_threads = 0;
+}
+
+
+size_t str_pool_get_num_threads(const StrPool *pool){
+    return pool->num_threads;
+}
+
+
+const StrPoolStats *str_pool_get_stats(const StrPool *pool, size_t thread){
+    /* What thread (0 being the calling thread) did during the last
+       parse or format call, or NULL if there's no such thread
+    */
+    return (thread < pool->num_threads) ? &pool->workers[thread].stats : NULL;
+}
+
+
+double str_pool_stats_get_throughput(const StrPoolStats *stats){
+    return (stats->seconds > 0) ? (double)stats->bytes / stats->seconds : 0;
+}
+
+
+
+/*                              * * *
+   PARSING
+
+   The text is cut into chunks of about STR_POOL_PARSE_CHUNK bytes, each
+   one ending just after a delimiter, i.e. where str_parse_longs() would
+   start a new field anyway. A first job counts the fields in each chunk
+   (the delimiters, plus a last field without one after it); the counts
+   add up to where each chunk's values go in values. A second job then
+   runs str_parse_longs() on every chunk, into its own place in values.
+
+   Parsing the whole buffer would stop at the first bad field or once
+   values is full, so the results are read in order, and the first chunk
+   that came up short (an error, or its share of max_values ran out)
+   decides how it ends.
+*/
+
+typedef struct parse_chunk Parse_chunk;
+typedef struct parse_context Parse_context;
+
+struct parse_chunk{
+    size_t start;       // its text is buf[start .. end)
+    size_t end;
+    size_t fields;
+    size_t offset;      // where its values go in values
+    size_t limit;       // how many of them fit before max_values
+    size_t parsed;
+    size_t consumed;
+    str_parse_err error;
+};
+
+struct parse_context{
+    const char *buf;
+    char delimiter;
+    long *values;
+    Parse_chunk *chunks;
+};
+
+
+static void count_fields(const StrPool_job *job, size_t c, StrPoolStats *stats){
+    Parse_context *context = job->context;
+    Parse_chunk *chunk = &context->chunks[c];
+    const char *text = context->buf + chunk->start;
+    size_t length = chunk->end - chunk->start;
+
+    (void)stats;
+    chunk->fields = str_count_occurrences_n(text, length, &context->delimiter, 1);
+    if (length > 0 && text[length - 1] != context->delimiter){
+        chunk->fields++;
+    }
+}
+
+
+static void parse_chunk(const StrPool_job *job, size_t c, StrPoolStats *stats){
+    Parse_context *context = job->context;
+    Parse_chunk *chunk = &context->chunks[c];
+
+    chunk->parsed = str_parse_longs(context->buf + chunk->start, chunk->end - chunk->start, context->delimiter,
+                                    context->values + chunk->offset, chunk->limit, &chunk->error, &chunk->consumed);
+    stats->bytes += chunk->consumed;
+    stats->values += chunk->parsed;
+}
+
+
+size_t str_parse_longs_parallel(StrPool *pool, const char buf[], size_t length, char delimiter,
+                                long values[], size_t max_values, str_parse_err *error, size_t *consumed){
+    /* str_parse_longs() on the pool's threads, with the same arguments and
+       the same results. Falls back to str_parse_longs() on the calling
+       thread if the chunk list can't be allocated.
+    */
+    size_t max_chunks = length / STR_POOL_PARSE_CHUNK + 1;
+    Parse_chunk *chunks = malloc(max_chunks * sizeof(Parse_chunk));
+
+    pool_reset_stats(pool);
+    if (!chunks){
+        return str_parse_longs(buf, length, delimiter, values, max_values, error, consumed);
+    }
+
+    size_t num_chunks = 0;
+    for (size_t start = 0; start < length; num_chunks++){
+        size_t end = length;
+        if (length - start > STR_POOL_PARSE_CHUNK){
+            // just past the first delimiter at or after the nominal end
+            const char *found = memchr(buf + start + STR_POOL_PARSE_CHUNK - 1, delimiter,
+                                       length - start - STR_POOL_PARSE_CHUNK + 1);
+            end = found ? (size_t)(found - buf) + 1 : length;
+        }
+        chunks[num_chunks].start = start;
+        chunks[num_chunks].end = end;
+        start = end;
+    }
+
+    Parse_context context = {buf, delimiter, values, chunks};
+    StrPool_job job = {count_fields, num_chunks, &context};
+    pool_run(pool, &job);
+
+    size_t offset = 0;
+    for (size_t c = 0; c < num_chunks; c++){
+        size_t room = (offset < max_values) ? max_values - offset : 0;
+        chunks[c].offset = (offset < max_values) ? offset : max_values;
+        chunks[c].limit = (chunks[c].fields < room) ? chunks[c].fields : room;
+        offset += chunks[c].fields;
+    }
+    job.run = parse_chunk;
+    pool_run(pool, &job);
+
+    size_t count = 0;
+    size_t position = length;
+    str_parse_err res = STR_PARSE_OK;
+    for (size_t c = 0; c < num_chunks; c++){
+        count += chunks[c].parsed;
+        if (chunks[c].error != STR_PARSE_OK || chunks[c].parsed < chunks[c].fields){
+            res = chunks[c].error;
+            position = chunks[c].start + chunks[c].consumed;
+            break;
+        }
+    }
+    free(chunks);
+
+    if (error){
+        *error = res;
+    }
+    if (consumed){
+        *consumed = position;
+    }
+    return count;
+}
+
+
+
+/*                              * * *
+   FORMATTING
+
+   The values are cut into chunks of STR_POOL_FORMAT_CHUNK. A first job
+   works out the length of each chunk's text from the digit counts, which
+   gives each chunk its place in buf; a second one formats the chunks
+   that fit into buf in their places, each followed by a delimiter unless
+   it's the last. str_format_longs() NUL-terminates what it writes, and
+   for every chunk but the last that NUL lands on the chunk's own
+   delimiter, which is written over it. If not all the chunks fit, the
+   one that doesn't is formatted on the calling thread, as far as it goes.
+*/
+
+typedef struct format_chunk Format_chunk;
+typedef struct format_context Format_context;
+
+struct format_chunk{
+    size_t first;       // its values are values[first .. first + count)
+    size_t count;
+    size_t length;      // of its text, without a delimiter after it
+    size_t offset;      // where its text goes in buf
+    bool delimited;     // followed by a delimiter
+};
+
+struct format_context{
+    char *buf;
+    const long *values;
+    char delimiter;
+    Format_chunk *chunks;
+};
+
+
+static size_t text_length(long num){
+    return (num == 0) ? 1 : str_count_digits(num) + (num < 0);
+}
+
+
+static void measure_chunk(const StrPool_job *job, size_t c, StrPoolStats *stats){
+    Format_context *context = job->context;
+    Format_chunk *chunk = &context->chunks[c];
+    size_t length = chunk->count - 1;   // the delimiters in between
+
+    (void)stats;
+    for (size_t i = 0; i < chunk->count; i++){
+        length += text_length(context->values[chunk->first + i]);
+    }
+    chunk->length = length;
+}
+
+
+static void format_chunk(const StrPool_job *job, size_t c, StrPoolStats *stats){
+    Format_context *context = job->context;
+    Format_chunk *chunk = &context->chunks[c];
+    char *text = context->buf + chunk->offset;
+
+    str_format_longs(text, chunk->length + 1, context->values + chunk->first, chunk->count,
+                     context->delimiter, NULL);
+    if (chunk->delimited){
+        text[chunk->length] = context->delimiter;
+    }
+    stats->bytes += chunk->length + chunk->delimited;
+    stats->values += chunk->count;
+}
+
+
+size_t str_format_longs_parallel(StrPool *pool, char buf[], size_t buf_size, const long values[], size_t count,
+                                 char delimiter, size_t *formatted){
+    /* str_format_longs() on the pool's threads, with the same arguments
+       and the same results. Falls back to str_format_longs() on the
+       calling thread if the chunk list can't be allocated.
+    */
+    size_t num_chunks = (count + STR_POOL_FORMAT_CHUNK - 1) / STR_POOL_FORMAT_CHUNK;
+    Format_chunk *chunks = (num_chunks > 0 && buf_size > 0) ? malloc(num_chunks * sizeof(Format_chunk)) : NULL;
+
+    pool_reset_stats(pool);
+    if (!chunks){
+        return str_format_longs(buf, buf_size, values, count, delimiter, formatted);
+    }
+    for (size_t c = 0; c < num_chunks; c++){
+        chunks[c].first = c * STR_POOL_FORMAT_CHUNK;
+        chunks[c].count = (count - chunks[c].first < STR_POOL_FORMAT_CHUNK) ? count - chunks[c].first
+                                                                             : STR_POOL_FORMAT_CHUNK;
+    }
+
+    Format_context context = {buf, values, delimiter, chunks};
+    StrPool_job job = {measure_chunk, num_chunks, &context};
+    pool_run(pool, &job);
+
+    // the chunks that fit whole, with the NUL after them
+    size_t offset = 0;
+    size_t fitting = 0;
+    for (; fitting < num_chunks; fitting++){
+        Format_chunk *chunk = &chunks[fitting];
+        if (chunk->length >= buf_size - offset){
+            break;
+        }
+        chunk->offset = offset;
+        chunk->delimited = (fitting + 1 < num_chunks);
+        offset += chunk->length + 1;
+    }
+    if (fitting == 0){
+        free(chunks);
+        return str_format_longs(buf, buf_size, values, count, delimiter, formatted);
+    }
+    job.run = format_chunk;
+    job.num_chunks = fitting;
+    pool_run(pool, &job);
+
+    size_t done = chunks[fitting - 1].first + chunks[fitting - 1].count;
+    size_t length = offset - 1;     // the last chunk's delimiter or NUL isn't counted
+    if (fitting < num_chunks){
+        size_t partial;
+        size_t partial_length = str_format_longs(buf + offset, buf_size - offset, values + done, count - done,
+                                                 delimiter, &partial);
+        if (partial > 0){
+            length = offset + partial_length;
+            done += partial;
+        }
+        else{
+            buf[length] = '\0';     // nothing after the delimiter, so it goes
+        }
+    }
+    free(chunks);
+
+    if (formatted){
+        *formatted = done;
+    }
+    return length;
+}
@@ -0,0 +1,88 @@
+#ifndef STR_PARALLEL_H
+#define STR_PARALLEL_H
+
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "pstrings.h"
+
+/* str_parse_longs() and str_format_longs() spread over several cores, for
+ * buffers too big for one core to get through fast enough.
+ *
+ * The work is split into chunks (a chunk of the text ends right after a
+ * delimiter, so no number is ever cut in two), and the chunks are run by
+ * a StrPool: a fixed set of threads started once and reused for every
+ * call. Each thread starts on its own contiguous share of the chunks and,
+ * once that's done, steals chunks from the shares of the others, so a
+ * thread that's slow (or descheduled) doesn't hold up the whole call.
+ * Each call first measures its chunks (how many values are in a chunk of
+ * text, how long the text of a chunk of values will be), so that every
+ * chunk can then be parsed or formatted straight into its place in the
+ * one output array: the results are in input order, and nothing is
+ * copied afterwards.
+ *
+ *     StrPool pool;
+ *     str_pool_init(&pool, 0);    // a thread per CPU
+ *     count = str_parse_longs_parallel(&pool, buf, length, '\n', values, max_values, &error, &consumed);
+ *     str_pool_destroy(&pool);
+ *
+ * The results are exactly those of str_parse_longs()/str_format_longs()
+ * on the whole buffer. What each thread did in the last call, and how
+ * fast, can be read back with str_pool_get_stats().
+ *
+ * A StrPool runs one call at a time: it can't be used from two threads at
+ * once. The thread that makes the call works on the chunks too.
+ */
+#define STR_POOL_CACHE_LINE 64
+#define STR_POOL_PARSE_CHUNK (1 << 20)      // bytes of text per chunk
+#define STR_POOL_FORMAT_CHUNK (1 << 16)     // values per chunk
+
+typedef struct str_pool StrPool;
+typedef struct str_pool_stats StrPoolStats;
+typedef struct str_pool_worker StrPool_worker;
+typedef struct str_pool_job StrPool_job;
+
+struct str_pool_stats{
+    size_t bytes;           // of text parsed or formatted
+    size_t values;
+    size_t chunks;          // run, in both of the call's passes
+    size_t chunks_stolen;   // of those, the ones taken from another thread's share
+    double seconds;         // spent working on chunks
+};
+
+struct str_pool_worker{
+    alignas(STR_POOL_CACHE_LINE) atomic_size_t next;    // the next chunk of this thread's share
+    size_t end;                                         // the end of the share
+    StrPoolStats stats;
+    StrPool *pool;
+};
+
+struct str_pool{
+    size_t num_threads;         // including the calling thread
+    pthread_t *threads;         // num_threads - 1 of them
+    StrPool_worker *workers;    // one per thread; the calling thread's is workers[0]
+    pthread_mutex_t lock;
+    pthread_cond_t start;       // a new job is there
+    pthread_cond_t finished;    // the last thread is done with it
+    unsigned long generation;   // counts the jobs
+    size_t running;             // threads still on the current job
+    bool shutdown;
+    const StrPool_job *job;
+};
+
+bool str_pool_init(StrPool *pool, size_t num_threads);     // 0 for one per online CPU
+void str_pool_destroy(StrPool *pool);
+size_t str_pool_get_num_threads(const StrPool *pool);
+const StrPoolStats *str_pool_get_stats(const StrPool *pool, size_t thread);     // from the last call
+double str_pool_stats_get_throughput(const StrPoolStats *stats);     // bytes per second
+
+size_t str_parse_longs_parallel(StrPool *pool, const char buf[], size_t length, char delimiter,
+                                long values[], size_t max_values, str_parse_err *error, size_t *consumed);
+size_t str_format_longs_parallel(StrPool *pool, char buf[], size_t buf_size, const long values[], size_t count,
+                                 char delimiter, size_t *formatted);
+
+
+#endif
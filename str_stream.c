@@ -0,0 +1,289 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "str_stream.h"
+
+
+/* Either way, the stream is a window of the file (data[0 .. length))
+   and a position in it, and each token is found by running the
+   StrTokenizer over what's left of the window. A mapped file is one
+   window that covers all of it. A file that's read has the buffer as its
+   window: when the tokenizer runs into the end of the window without
+   finding a delimiter, the token might go on in the next chunk, so the
+   part of it seen so far is moved to the front of the buffer, the next
+   chunk is read in after it, and the token is looked for again. Only at
+   the end of the file is running into the end of the window the end of
+   the last token.
+*/
+
+static void stream_init(StrStream *stream, char delimiter){
+    stream->position = 0;
+    stream->eof = false;
+    stream->done = false;
+    stream->error = 0;
+    stream->fd = -1;
+    stream->owns_fd = false;
+    stream->buffer = NULL;
+    stream->buffer_size = 0;
+    stream->mapping = NULL;
+    stream->mapping_length = 0;
+    str_tokenizer_init(&stream->tokenizer, "", 0, delimiter);
+}
+
+
+bool str_stream_open_fd(StrStream *stream, int fd, size_t buffer_size, char delimiter){
+    /* Tokenize what read() gets from fd (a file, a pipe, a socket...),
+       starting where fd is now, in chunks of up to buffer_size bytes.
+       fd is left open by str_stream_close(). Return false if the buffer
+       can't be allocated.
+    */
+    buffer_size = buffer_size ? buffer_size : STR_STREAM_DEFAULT_BUFFER;
+    char *buffer = malloc(buffer_size);
+    if (!buffer){
+        return false;
+    }
+    stream_init(stream, delimiter);
+    stream->fd = fd;
+    stream->buffer = buffer;
+    stream->buffer_size = buffer_size;
+    stream->data = buffer;
+    stream->length = 0;
+    return true;
+}
+
+
+bool str_stream_open_file(StrStream *stream, const char path[], char delimiter){
+    /* Tokenize the file at path. A regular file is mmap'd and tokenized
+       in place; anything else (or a file that can't be mapped) is read
+       in chunks instead. Return false, with errno set, if the file can't
+       be opened or the buffer can't be allocated.
+    */
+    int fd = open(path, O_RDONLY);
+    if (fd < 0){
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0
+        && (uintmax_t)info.st_size <= SIZE_MAX){
+        size_t size = (size_t)info.st_size;
+        void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED){
+            posix_madvise(mapping, size, POSIX_MADV_SEQUENTIAL);   // only a hint; failing is fine
+            close(fd);  // the mapping doesn't need it
+            stream_init(stream, delimiter);
+            stream->mapping = mapping;
+            stream->mapping_length = size;
+            stream->data = mapping;
+            stream->length = size;
+            stream->eof = true;
+            return true;
+        }
+    }
+
+    if (!str_stream_open_fd(stream, fd, 0, delimiter)){
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return false;
+    }
+    stream->owns_fd = true;
+    return true;
+}
+
+
+void str_stream_close(StrStream *stream){
+    /* Unmap or free what the stream uses, and close the file if the
+       stream opened it. Its tokens aren't valid anymore.
+    */
+    if (stream->mapping){
+        munmap(stream->mapping, stream->mapping_length);
+    }
+    free(stream->buffer);
+    if (stream->owns_fd){
+        close(stream->fd);
+    }
+    stream_init(stream, '\0');
+    stream->data = "";
+    stream->length = 0;
+    stream->done = true;
+}
+
+
+void str_stream_set_delimiters(StrStream *stream, const char delimiters[], size_t num_delimiters){
+    /* Split on any one of the num_delimiters chars in delimiters, which
+       has to outlive the stream.
+    */
+    str_tokenizer_init_set(&stream->tokenizer, "", 0, delimiters, num_delimiters);
+}
+
+
+void str_stream_set_delimiter_seq(StrStream *stream, const char delimiter[], size_t delimiter_length){
+    /* Split on the multi-char delimiter, which has to outlive the stream.
+       A delimiter cut in two by the end of a chunk is found all the same.
+    */
+    str_tokenizer_init_seq(&stream->tokenizer, "", 0, delimiter, delimiter_length);
+}
+
+
+int str_stream_get_error(const StrStream *stream){
+    return stream->error;
+}
+
+
+static bool stream_refill(StrStream *stream){
+    /* Move the unfinished token at position to the front of the buffer,
+       growing the buffer if the token already fills all of it, and read
+       the next chunk in after it. Return false on a read error (or if
+       the buffer can't grow); the end of the file just sets eof.
+    */
+    size_t keep = stream->length - stream->position;
+
+    if (stream->position > 0){
+        memmove(stream->buffer, stream->buffer + stream->position, keep);
+    }
+    else if (keep == stream->buffer_size){
+        size_t new_size = stream->buffer_size * 2;
+        char *buffer = (new_size > stream->buffer_size) ? realloc(stream->buffer, new_size) : NULL;
+        if (!buffer){
+            stream->error = ENOMEM;
+            return false;
+        }
+        stream->buffer = buffer;
+        stream->buffer_size = new_size;
+    }
+    stream->data = stream->buffer;
+    stream->position = 0;
+    stream->length = keep;
+
+    for (;;){
+        ssize_t res = read(stream->fd, stream->buffer + keep, stream->buffer_size - keep);
+        if (res > 0){
+            stream->length += (size_t)res;
+            return true;
+        }
+        if (res == 0){
+            stream->eof = true;
+            return true;
+        }
+        if (errno != EINTR){
+            stream->error = errno;
+            return false;
+        }
+    }
+}
+
+
+bool str_stream_next(StrStream *stream, StrToken *token){
+    /* Store the next token in *token and return true, or return false
+       once the file is exhausted or on a read error. The token stays
+       valid until the next call on the stream.
+    */
+    StrTokenizer *tokenizer = &stream->tokenizer;
+
+    while (!stream->done){
+        str_tokenizer_reset(tokenizer, stream->data + stream->position, stream->length - stream->position);
+        str_tokenizer_next(tokenizer, token);
+        if (!tokenizer->done){
+            stream->position += tokenizer->position;    // past the delimiter
+            return true;
+        }
+        if (stream->eof){
+            stream->position = stream->length;
+            stream->done = true;    // no delimiter before the end of the file: the last token
+            return true;
+        }
+        if (!stream_refill(stream)){
+            stream->done = true;
+        }
+    }
+    return false;
+}
+
+
+static size_t stream_parse_tokens(StrStream *stream, long values[], size_t max_values, str_parse_err *error){
+    /* str_stream_parse_longs() for delimiter sets and sequences, a token at a time */
+    StrToken token;
+    size_t count = 0;
+    str_parse_err res = STR_PARSE_OK;
+
+    while (count < max_values && str_stream_next(stream, &token)){
+        if (token.length == 0 && stream->done){
+            break;      // after a delimiter at the end of the file
+        }
+        size_t consumed;
+        res = str_parse_long(token.ptr, token.length, &values[count], &consumed);
+        if (res != STR_PARSE_OK){
+            if (res == STR_PARSE_EMPTY && consumed < token.length){
+                res = STR_PARSE_BAD_CHAR;
+            }
+            break;
+        }
+        count++;
+    }
+    *error = res;
+    return count;
+}
+
+
+size_t str_stream_parse_longs(StrStream *stream, long values[], size_t max_values, str_parse_err *error){
+    /* Parse the integers in the rest of the file, one per token, into
+       values, and return how many were stored. This is str_parse_longs()
+       over the whole file: a delimiter at the very end is fine, parsing
+       stops once max_values have been stored (call again for the rest) or
+       at the first field that isn't a valid integer, and *error (unless
+       it's NULL) gets that field's error, or STR_PARSE_OK. A read error
+       also stops it; check str_stream_get_error().
+
+       With a single delimiter char, each chunk goes to str_parse_longs()
+       whole, up to its last delimiter; the field cut off by the end of
+       the chunk is finished once the next one has been read.
+    */
+    str_parse_err res = STR_PARSE_OK;
+    size_t count = 0;
+
+    if (stream->tokenizer.mode != STR_TOK_CHAR){
+        count = stream_parse_tokens(stream, values, max_values, &res);
+    }
+    else{
+        char delimiter = stream->tokenizer.delimiter;
+        while (count < max_values && !stream->done){
+            const char *window = stream->data + stream->position;
+            size_t available = stream->length - stream->position;
+            size_t complete = available;
+
+            if (!stream->eof){
+                while (complete > 0 && window[complete - 1] != delimiter){
+                    complete--;
+                }
+            }
+            if (complete > 0){
+                size_t consumed;
+                count += str_parse_longs(window, complete, delimiter, values + count, max_values - count,
+                                         &res, &consumed);
+                stream->position += consumed;
+                if (res != STR_PARSE_OK || consumed < complete){
+                    break;      // a bad field, or values is full
+                }
+            }
+            if (stream->eof){
+                stream->done = true;
+            }
+            else if (!stream_refill(stream)){
+                stream->done = true;
+            }
+        }
+    }
+    if (error){
+        *error = res;
+    }
+    return count;
+}
@@ -0,0 +1,70 @@
+#ifndef STR_STREAM_H
+#define STR_STREAM_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "pstrings.h"
+
+/* A StrTokenizer over a file instead of a buffer, for inputs too big to
+ * read into memory first. The file is either mmap'd, with the tokens
+ * coming straight out of the mapping, or read() chunk by chunk into one
+ * buffer that's reused for the whole file. Either way the tokens are
+ * views, never copies: StrToken.ptr points into the mapping or the
+ * buffer, and stays valid until the next call on the stream.
+ *
+ * A token that straddles two chunks is handled by moving the start of it
+ * to the front of the buffer before reading the next chunk, so only that
+ * one partial token is ever copied; a token longer than the whole buffer
+ * makes the buffer grow. Tokens are split the same way a StrTokenizer
+ * splits them, including an empty last token after a trailing delimiter.
+ *
+ *     StrStream stream;
+ *     StrToken token;
+ *     if (str_stream_open_file(&stream, "data.csv", '\n')){
+ *         while (str_stream_next(&stream, &token)){
+ *             // token.ptr[0 .. token.length) is the next line
+ *         }
+ *         str_stream_close(&stream);
+ *     }
+ *
+ * For a file of integers, str_stream_parse_longs() runs str_parse_longs()
+ * on each chunk directly, rather than going through the tokens one by one.
+ *
+ * The functions return false once the input is exhausted or on an error;
+ * str_stream_get_error() tells the two apart.
+ */
+#define STR_STREAM_DEFAULT_BUFFER 65536     // bytes, if 0 is passed to str_stream_open_fd
+
+typedef struct str_stream StrStream;
+
+struct str_stream{
+    const char *data;       // the current window into the file: the mapping, or buffer
+    size_t length;          // bytes in the window
+    size_t position;        // where the next token starts
+    bool eof;               // the window reaches the end of the file
+    bool done;              // the last token has been handed out
+    int error;              // the errno of a failed read, or 0
+    int fd;                 // the file being read, or -1 if it's mmap'd
+    bool owns_fd;           // opened by str_stream_open_file, so closed by str_stream_close
+    char *buffer;           // NULL if the file is mmap'd
+    size_t buffer_size;
+    void *mapping;          // NULL if the file is read
+    size_t mapping_length;
+    StrTokenizer tokenizer;     // the delimiters, run over the window
+};
+
+bool str_stream_open_fd(StrStream *stream, int fd, size_t buffer_size, char delimiter);    // read() fd in chunks
+bool str_stream_open_file(StrStream *stream, const char path[], char delimiter);   // mmap path, or read it if it can't be
+void str_stream_close(StrStream *stream);
+
+// split on any of the chars in delimiters, or on the sequence delimiter, instead; call before the first token
+void str_stream_set_delimiters(StrStream *stream, const char delimiters[], size_t num_delimiters);
+void str_stream_set_delimiter_seq(StrStream *stream, const char delimiter[], size_t delimiter_length);
+
+bool str_stream_next(StrStream *stream, StrToken *token);
+size_t str_stream_parse_longs(StrStream *stream, long values[], size_t max_values, str_parse_err *error);
+int str_stream_get_error(const StrStream *stream);     // an errno value, or 0 if there was no error
+
+
+#endif
@@ -0,0 +1,480 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu_features.h"
+#include "pstrings.h"
+#include "string_map.h"
+
+#if CPU_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+
+
+/*                              * * *
+   GROUP PROBING
+
+   A key's hash is split in two: the high bits (hash >> 7) pick the slot
+   where its probe starts, and the low 7 bits (H2) go in the control byte.
+   A probe looks at SM_GROUP_SIZE control bytes at a time, starting at any
+   slot, and moves on by one more group each step (triangular probing,
+   which visits every group when the capacity is a power of 2). It stops
+   at the first group with an EMPTY byte: an insert would have put the key
+   there or earlier.
+   The control array has a copy of its first group after its end, so a
+   group that starts near the end of the table can still be loaded in one go.
+
+   The group compares have an SSE2 version (one PCMPEQB + PMOVMSKB) and a
+   SWAR one that does the two halves of the group as 64-bit words. The
+   probe loops are built from either by SM_DEFINE_PROBES, and the one to
+   use is picked before main() by SM_init_kernels(), like in pstrings.
+*/
+
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xFE
+// a full slot's control byte is its H2, 0x00..0x7F: the high bit means empty or deleted
+#define CTRL_IS_FULL(c) ((c) < 0x80)
+
+#define NOT_FOUND SIZE_MAX
+#define SM_SEED 0x9E3779B97F4A7C15ULL
+#define SM_KEY_CHUNK 16384
+
+#define ONES_64  0x0101010101010101ULL
+#define HIGHS_64 0x8080808080808080ULL
+#define LOWS_64  0x7F7F7F7F7F7F7F7FULL
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SM_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define SM_PREFETCH(p) ((void)(p))
+#endif
+
+
+static inline size_t h1_of(uint64_t hash){
+    return (size_t)(hash >> 7);
+}
+
+
+static inline uint8_t h2_of(uint64_t hash){
+    return (uint8_t)(hash & 0x7F);
+}
+
+
+static inline uint64_t load_half(const uint8_t *p){
+    /* 8 control bytes, the first one in the lowest byte */
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
+
+static inline uint32_t high_bits_to_mask(uint64_t w){
+    /* Gather the high bit of each byte of w into bits 0..7; the multiply
+       moves bit 8k to bit 56 + k without any of the products overlapping
+    */
+    return (uint32_t)((((w & HIGHS_64) >> 7) * 0x0102040810204080ULL) >> 56);
+}
+
+
+static inline uint32_t match_byte_word(const uint8_t *group, uint8_t c){
+    /* Bit i set if group[i] == c */
+    uint64_t pattern = ONES_64 * c;
+    uint64_t lo = load_half(group) ^ pattern;
+    uint64_t hi = load_half(group + 8) ^ pattern;
+    // the high bit of each byte that is 0; exact, unlike the usual (x - ONES) & ~x test
+    lo = ~(((lo & LOWS_64) + LOWS_64) | lo | LOWS_64);
+    hi = ~(((hi & LOWS_64) + LOWS_64) | hi | LOWS_64);
+    return high_bits_to_mask(lo) | (high_bits_to_mask(hi) << 8);
+}
+
+
+static inline uint32_t match_free_word(const uint8_t *group){
+    /* Bit i set if group[i] is EMPTY or DELETED */
+    return high_bits_to_mask(load_half(group)) | (high_bits_to_mask(load_half(group + 8)) << 8);
+}
+
+
+#define SM_DEFINE_PROBES(suffix, attributes) \
+    attributes \
+    static size_t find_##suffix(const StringMap *map, const char *key, size_t length, uint64_t hash){ \
+        /* The slot holding key, or NOT_FOUND */ \
+        size_t mask = map->capacity - 1; \
+        size_t position = h1_of(hash) & mask; \
+        uint8_t h2 = h2_of(hash); \
+        for (size_t step = SM_GROUP_SIZE; ; step += SM_GROUP_SIZE){ \
+            const uint8_t *group = map->ctrl + position; \
+            for (uint32_t candidates = match_byte_##suffix(group, h2); candidates; candidates &= candidates - 1){ \
+                size_t i = (position + __builtin_ctz(candidates)) & mask; \
+                const SM_slot *slot = &map->slots[i]; \
+                if (slot->hash == hash && str_is_same_n(slot->key, slot->length, key, length)){ \
+                    return i; \
+                } \
+            } \
+            if (match_byte_##suffix(group, CTRL_EMPTY)){ \
+                return NOT_FOUND; \
+            } \
+            position = (position + step) & mask; \
+        } \
+    } \
+    \
+    attributes \
+    static size_t find_free_##suffix(const StringMap *map, uint64_t hash){ \
+        /* The first EMPTY or DELETED slot on hash's probe sequence. There \
+           always is one, as the table is never more than 7/8 full. \
+        */ \
+        size_t mask = map->capacity - 1; \
+        size_t position = h1_of(hash) & mask; \
+        for (size_t step = SM_GROUP_SIZE; ; step += SM_GROUP_SIZE){ \
+            uint32_t free_slots = match_free_##suffix(map->ctrl + position); \
+            if (free_slots){ \
+                return (position + __builtin_ctz(free_slots)) & mask; \
+            } \
+            position = (position + step) & mask; \
+        } \
+    }
+
+SM_DEFINE_PROBES(word, )
+
+
+#if CPU_X86_DISPATCH
+
+CPU_TARGET("sse2")
+static inline uint32_t match_byte_sse2(const uint8_t *group, uint8_t c){
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)c)));
+}
+
+
+CPU_TARGET("sse2")
+static inline uint32_t match_free_sse2(const uint8_t *group){
+    // EMPTY and DELETED are the only control bytes with the high bit set
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+}
+
+SM_DEFINE_PROBES(sse2, CPU_TARGET("sse2"))
+
+#endif  // CPU_X86_DISPATCH
+
+
+static size_t (*find_kernel)(const StringMap *, const char *, size_t, uint64_t) = find_word;
+static size_t (*find_free_kernel)(const StringMap *, uint64_t) = find_free_word;
+
+
+CPU_CONSTRUCTOR
+static void SM_init_kernels(void){
+#if CPU_X86_DISPATCH
+    if (cpu_simd_level() >= SIMD_SSE2){
+        find_kernel = find_sse2;
+        find_free_kernel = find_free_sse2;
+    }
+#endif
+}
+
+
+
+/*                              * * *
+   TABLE
+*/
+
+static size_t max_load(size_t capacity){
+    /* Full and deleted slots together are kept to 7/8 of the table */
+    return capacity - capacity / 8;
+}
+
+
+static size_t capacity_for(size_t num_items){
+    size_t capacity = SM_GROUP_SIZE;
+    while (max_load(capacity) < num_items){
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+
+static void set_ctrl(StringMap *map, size_t i, uint8_t c){
+    map->ctrl[i] = c;
+    if (i < SM_GROUP_SIZE){
+        map->ctrl[map->capacity + i] = c;     // the mirrored first group
+    }
+}
+
+
+static bool allocate_table(StringMap *table, size_t capacity){
+    /* Give table an all-EMPTY table of capacity slots. The slots and the
+       control bytes share one allocation, slots first.
+    */
+    SM_slot *slots = malloc(capacity * sizeof(SM_slot) + capacity + SM_GROUP_SIZE);
+    if (!slots){
+        return false;
+    }
+    table->slots = slots;
+    table->ctrl = (uint8_t *)(slots + capacity);
+    table->capacity = capacity;
+    memset(table->ctrl, CTRL_EMPTY, capacity + SM_GROUP_SIZE);
+    return true;
+}
+
+
+static bool rehash(StringMap *map, size_t capacity){
+    /* Move every item into a new table of capacity slots, dropping the
+       DELETED ones. The slots keep their hashes, so the keys aren't touched.
+    */
+    StringMap table;
+
+    if (!allocate_table(&table, capacity)){
+        return false;
+    }
+    for (size_t i = 0; i < map->capacity; i++){
+        if (CTRL_IS_FULL(map->ctrl[i])){
+            size_t j = find_free_kernel(&table, map->slots[i].hash);
+            set_ctrl(&table, j, map->ctrl[i]);
+            table.slots[j] = map->slots[i];
+        }
+    }
+    free(map->slots);
+    map->slots = table.slots;
+    map->ctrl = table.ctrl;
+    map->capacity = capacity;
+    map->num_deleted = 0;
+    map->growth_left = max_load(capacity) - map->num_items;
+    return true;
+}
+
+
+static bool make_room(StringMap *map){
+    /* Called when there are no EMPTY slots left to insert into. If most of
+       the used-up slots are tombstones, clearing them out is enough;
+       otherwise the table doubles.
+    */
+    if (map->num_items + 1 <= max_load(map->capacity) / 2){
+        return rehash(map, map->capacity);
+    }
+    return rehash(map, map->capacity * 2);
+}
+
+
+static const char *store_key(StringMap *map, const char key[], size_t length){
+    /* Copy key, NUL-terminated, into the arena */
+    char *copy = arena_alloc_aligned(&map->keys, length + 1, 1);
+    if (copy){
+        memcpy(copy, key, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+
+
+/*                              * * *
+   STRING MAP
+*/
+
+bool SM_init(StringMap *map, size_t num_items){
+    /* Set up an empty map that can take num_items items before it has to
+       grow (0 is fine). Return false if the memory can't be allocated.
+    */
+    if (!allocate_table(map, capacity_for(num_items))){
+        return false;
+    }
+    map->num_items = 0;
+    map->num_deleted = 0;
+    map->growth_left = max_load(map->capacity);
+    arena_init(&map->keys, SM_KEY_CHUNK);
+    return true;
+}
+
+
+void SM_destroy(StringMap *map){
+    free(map->slots);
+    arena_free(&map->keys);
+    map->slots = NULL;
+    map->ctrl = NULL;
+    map->capacity = 0;
+    map->num_items = 0;
+    map->num_deleted = 0;
+    map->growth_left = 0;
+}
+
+
+void SM_clear(StringMap *map){
+    /* Remove all items. The table keeps its size, and the arena keeps its
+       chunks for the next keys.
+    */
+    memset(map->ctrl, CTRL_EMPTY, map->capacity + SM_GROUP_SIZE);
+    map->num_items = 0;
+    map->num_deleted = 0;
+    map->growth_left = max_load(map->capacity);
+    arena_reset(&map->keys);
+}
+
+
+size_t SM_get_num_items(const StringMap *map){
+    return map->num_items;
+}
+
+
+bool SM_is_empty(const StringMap *map){
+    return map->num_items == 0;
+}
+
+
+bool SM_reserve(StringMap *map, size_t num_items){
+    /* Make sure num_items items fit without the table growing again. Any
+       tombstones are cleared out along the way.
+    */
+    if (num_items <= map->num_items + map->growth_left){
+        return true;
+    }
+    return rehash(map, capacity_for(num_items));
+}
+
+
+bool SM_put(StringMap *map, const char key[], size_t length, void *value){
+    /* Map key to value, replacing the value if key is already in the map.
+       The map keeps its own copy of key.
+    */
+    uint64_t hash = str_hash_n(key, length, SM_SEED);
+    size_t i = find_kernel(map, key, length, hash);
+
+    if (i != NOT_FOUND){
+        map->slots[i].value = value;
+        return true;
+    }
+    if (map->growth_left == 0 && !make_room(map)){
+        return false;
+    }
+    const char *copy = store_key(map, key, length);
+    if (!copy){
+        return false;
+    }
+    i = find_free_kernel(map, hash);
+    if (map->ctrl[i] == CTRL_EMPTY){
+        map->growth_left--;
+    }
+    else{
+        map->num_deleted--;     // reusing a tombstone
+    }
+    set_ctrl(map, i, h2_of(hash));
+    map->slots[i].key = copy;
+    map->slots[i].length = length;
+    map->slots[i].hash = hash;
+    map->slots[i].value = value;
+    map->num_items++;
+    return true;
+}
+
+
+void **SM_get_ptr(const StringMap *map, const char key[], size_t length){
+    /* Where key's value is stored, so it can be updated in place */
+    size_t i = find_kernel(map, key, length, str_hash_n(key, length, SM_SEED));
+    return (i == NOT_FOUND) ? NULL : &map->slots[i].value;
+}
+
+
+bool SM_get(const StringMap *map, const char key[], size_t length, void **value){
+    /* Store key's value in *value and return true, or return false if key isn't in the map */
+    void **found = SM_get_ptr(map, key, length);
+    if (!found){
+        return false;
+    }
+    *value = *found;
+    return true;
+}
+
+
+bool SM_contains(const StringMap *map, const char key[], size_t length){
+    return SM_get_ptr(map, key, length) != NULL;
+}
+
+
+bool SM_remove(StringMap *map, const char key[], size_t length){
+    /* Remove key and return true, or return false if it wasn't there.
+       The slot normally becomes a tombstone, so probes that went past it
+       keep going. But if no group-sized window around it has ever been
+       full, no probe can have gone past it, and it goes straight back to
+       EMPTY.
+    */
+    size_t i = find_kernel(map, key, length, str_hash_n(key, length, SM_SEED));
+    if (i == NOT_FOUND){
+        return false;
+    }
+    size_t mask = map->capacity - 1;
+    uint32_t empty_after = match_byte_word(map->ctrl + i, CTRL_EMPTY);
+    uint32_t empty_before = match_byte_word(map->ctrl + ((i - SM_GROUP_SIZE) & mask), CTRL_EMPTY);
+    // full slots from i onwards, and running back from just before i
+    unsigned run_after = empty_after ? __builtin_ctz(empty_after) : SM_GROUP_SIZE;
+    unsigned run_before = empty_before ? __builtin_clz(empty_before) - (32 - SM_GROUP_SIZE) : SM_GROUP_SIZE;
+
+    if (run_after + run_before < SM_GROUP_SIZE){
+        set_ctrl(map, i, CTRL_EMPTY);
+        map->growth_left++;
+    }
+    else{
+        set_ctrl(map, i, CTRL_DELETED);
+        map->num_deleted++;
+    }
+    map->num_items--;
+    return true;
+}
+
+
+size_t SM_get_many(const StringMap *map, const char *const keys[], const size_t lengths[], size_t count,
+                   void *values[], bool found[]){
+    /* Look keys up in batches. A batch is hashed first and the start of
+       each key's probe (its first control group and slot) prefetched,
+       so by the time the probes run, the cache misses of the whole batch
+       have been waiting on memory side by side instead of one after another.
+       Keys that aren't in the map get a NULL value.
+    */
+    enum{BATCH = 16};
+    uint64_t hashes[BATCH];
+    size_t mask = map->capacity - 1;
+    size_t num_found = 0;
+
+    for (size_t start = 0; start < count; start += BATCH){
+        size_t n = (count - start < BATCH) ? count - start : BATCH;
+        str_hash_many(keys + start, lengths + start, n, SM_SEED, hashes);
+        for (size_t j = 0; j < n; j++){
+            size_t position = h1_of(hashes[j]) & mask;
+            SM_PREFETCH(map->ctrl + position);
+            SM_PREFETCH(&map->slots[position]);
+        }
+        for (size_t j = 0; j < n; j++){
+            size_t i = find_kernel(map, keys[start + j], lengths[start + j], hashes[j]);
+            values[start + j] = (i == NOT_FOUND) ? NULL : map->slots[i].value;
+            if (found){
+                found[start + j] = (i != NOT_FOUND);
+            }
+            num_found += (i != NOT_FOUND);
+        }
+    }
+    return num_found;
+}
+
+
+bool SM_next(const StringMap *map, size_t *position, const char **key, size_t *length, void **value){
+    /* Hand out the next item from *position on and move *position past it.
+       key and length are the map's own NUL-terminated copy. Any of key,
+       length and value can be NULL.
+    */
+    for (size_t i = *position; i < map->capacity; i++){
+        if (CTRL_IS_FULL(map->ctrl[i])){
+            if (key){
+                *key = map->slots[i].key;
+            }
+            if (length){
+                *length = map->slots[i].length;
+            }
+            if (value){
+                *value = map->slots[i].value;
+            }
+            *position = i + 1;
+            return true;
+        }
+    }
+    *position = map->capacity;
+    return false;
+}
@@ -0,0 +1,78 @@
+#ifndef STRING_MAP_H
+#define STRING_MAP_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+/* A hash map from strings to void pointers, laid out like a Swiss table.
+ *
+ * The slots are one flat array probed with open addressing. Next to them
+ * is an array of control bytes, one per slot: EMPTY, DELETED, or the low 7
+ * bits of the key's hash when the slot is full. A lookup loads the 16
+ * control bytes of a group at once and compares all of them with the key's
+ * 7 bits in one vector compare (SSE2, or 64-bit SWAR elsewhere), so only
+ * slots whose 7 bits match, about 1 in 128 of the others, have their key
+ * compared. Each slot also keeps its key's full hash, which is checked
+ * before the key itself and lets the table be resized without reading or
+ * rehashing a single key.
+ *
+ * The map copies each key into an Arena it owns, so SM_put() only
+ * allocates when an arena chunk fills up or the table grows. Keys don't
+ * need a NUL and can contain NULs; the map's copies are NUL-terminated.
+ * The memory of removed keys is only given back by SM_clear() and
+ * SM_destroy().
+ *
+ * A StringMap is set up with SM_init() and released with SM_destroy().
+ * The functions that can allocate return false if malloc fails, leaving
+ * the map as it was. Pointers into the map (SM_get_ptr(), the keys
+ * SM_next() hands out) are valid until the map is next modified.
+ */
+#define SM_GROUP_SIZE 16
+
+typedef struct string_map StringMap;
+typedef struct string_map_slot SM_slot;
+
+struct string_map_slot{
+const char *key;    // in the map's arena
+size_t length;
+uint64_t hash;
+void *value;
+};
+
+struct string_map{
+uint8_t *ctrl;          // capacity + SM_GROUP_SIZE bytes; the last group mirrors the first
+SM_slot *slots;
+size_t capacity;        // a power of 2, at least SM_GROUP_SIZE
+size_t num_items;
+size_t num_deleted;
+size_t growth_left;     // inserts into EMPTY slots before the table has to grow
+Arena keys;
+};
+
+bool SM_init(StringMap *map, size_t num_items);   // with room for num_items before it has to grow
+void SM_destroy(StringMap *map);
+void SM_clear(StringMap *map);     // remove everything, keeping the table and the key arena's chunks
+size_t SM_get_num_items(const StringMap *map);
+bool SM_is_empty(const StringMap *map);
+bool SM_reserve(StringMap *map, size_t num_items);   // room for num_items without growing
+
+bool SM_put(StringMap *map, const char key[], size_t length, void *value);     // insert, or replace the value
+bool SM_get(const StringMap *map, const char key[], size_t length, void **value);
+void **SM_get_ptr(const StringMap *map, const char key[], size_t length);     // NULL if key isn't there
+bool SM_contains(const StringMap *map, const char key[], size_t length);
+bool SM_remove(StringMap *map, const char key[], size_t length);
+
+// look up count keys at once; values[i] (and found[i], unless found is NULL) for each, and return how many were found
+size_t SM_get_many(const StringMap *map, const char *const keys[], const size_t lengths[], size_t count,
+                   void *values[], bool found[]);
+
+/* Iterate over the map in table order: start with *position = 0 and call
+ * SM_next() until it returns false. The map mustn't be modified in between.
+ */
+bool SM_next(const StringMap *map, size_t *position, const char **key, size_t *length, void **value);
+
+
+#endif
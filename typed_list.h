@@ -0,0 +1,153 @@
+#ifndef TYPED_LIST_H
+#define TYPED_LIST_H
+
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/* DEFINE_LIST(name, T) generates a doubly linked list of T, with the same
+ * operations as linked_list.h, where each value is stored inside its node
+ * rather than behind a pointer. For example
+ *
+ *     DEFINE_LIST(PointList, struct point)
+ *
+ * defines the types PointList and PointList_node, and the functions
+ *
+ *     void PointList_init(PointList *list);
+ *     size_t PointList_get_num_items(const PointList *list);
+ *     bool PointList_is_empty(const PointList *list);
+ *     void PointList_destroy(PointList *list);
+ *     void PointList_append(PointList *list, struct point val);
+ *     void PointList_prepend(PointList *list, struct point val);
+ *     struct point PointList_head_pop(PointList *list);
+ *     struct point PointList_tail_pop(PointList *list);
+ *     struct point *PointList_head(PointList *list);    // NULL if the list is empty
+ *     struct point *PointList_tail(PointList *list);
+ *
+ * The functions are static inline, so DEFINE_LIST can be used in a header
+ * and every file that includes it gets its own copy, specialized for T.
+ * T has to be a type name that can be followed by a declarator, so use a
+ * typedef for pointer-to-function or array types.
+ *
+ * Like LL_prepend(), popping an empty list isn't allowed, but unlike it,
+ * prepending to an empty list is.
+ */
+#define DEFINE_LIST(name, T) \
+    typedef struct name name; \
+    typedef struct name##_node name##_node; \
+    \
+    struct name##_node{ \
+        name##_node *previous; \
+        name##_node *next; \
+        T data; \
+    }; \
+    \
+    struct name{ \
+        name##_node *head_ptr; \
+        name##_node *tail_ptr; \
+        size_t number_of_items; \
+    }; \
+    \
+    static inline void name##_init(name *list){ \
+        list->head_ptr = NULL; \
+        list->tail_ptr = NULL; \
+        list->number_of_items = 0; \
+    } \
+    \
+    static inline size_t name##_get_num_items(const name *list){ \
+        return list->number_of_items; \
+    } \
+    \
+    static inline bool name##_is_empty(const name *list){ \
+        return list->number_of_items == 0; \
+    } \
+    \
+    static inline void name##_destroy(name *list){ \
+        name##_node *node = list->head_ptr; \
+        while (node){ \
+            name##_node *next = node->next; \
+            free(node); \
+            node = next; \
+        } \
+        name##_init(list); \
+    } \
+    \
+    static inline name##_node *name##_build_node(T val){ \
+        name##_node *node = malloc(sizeof(name##_node)); \
+        assert(node != NULL);   /* same as LL_build_node */ \
+        node->previous = NULL; \
+        node->next = NULL; \
+        node->data = val; \
+        return node; \
+    } \
+    \
+    static inline void name##_append(name *list, T val){ \
+        name##_node *node = name##_build_node(val); \
+        node->previous = list->tail_ptr; \
+        if (list->tail_ptr){ \
+            list->tail_ptr->next = node; \
+        } \
+        else{ \
+            list->head_ptr = node; \
+        } \
+        list->tail_ptr = node; \
+        list->number_of_items++; \
+    } \
+    \
+    static inline void name##_prepend(name *list, T val){ \
+        name##_node *node = name##_build_node(val); \
+        node->next = list->head_ptr; \
+        if (list->head_ptr){ \
+            list->head_ptr->previous = node; \
+        } \
+        else{ \
+            list->tail_ptr = node; \
+        } \
+        list->head_ptr = node; \
+        list->number_of_items++; \
+    } \
+    \
+    static inline T name##_head_pop(name *list){ \
+        assert(list->number_of_items > 0); \
+        name##_node *former_head = list->head_ptr; \
+        T val = former_head->data; \
+        list->head_ptr = former_head->next; \
+        if (list->head_ptr){ \
+            list->head_ptr->previous = NULL; \
+        } \
+        else{ \
+            list->tail_ptr = NULL; \
+        } \
+        free(former_head); \
+        list->number_of_items--; \
+        return val; \
+    } \
+    \
+    static inline T name##_tail_pop(name *list){ \
+        assert(list->number_of_items > 0); \
+        name##_node *former_tail = list->tail_ptr; \
+        T val = former_tail->data; \
+        list->tail_ptr = former_tail->previous; \
+        if (list->tail_ptr){ \
+            list->tail_ptr->next = NULL; \
+        } \
+        else{ \
+            list->head_ptr = NULL; \
+        } \
+        free(former_tail); \
+        list->number_of_items--; \
+        return val; \
+    } \
+    \
+    static inline T *name##_head(name *list){ \
+        return list->head_ptr ? &list->head_ptr->data : NULL; \
+    } \
+    \
+    static inline T *name##_tail(name *list){ \
+        return list->tail_ptr ? &list->tail_ptr->data : NULL; \
+    }
+
+
+#endif
@@ -0,0 +1,197 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unrolled_list.h"
+
+
+_Static_assert(sizeof(UnrolledList_block) == ULL_BLOCK_SIZE, "UnrolledList_block has padding");
+_Static_assert(ULL_BLOCK_SIZE % ULL_CACHE_LINE == 0, "ULL_BLOCK_SIZE must be a multiple of the cache line");
+
+
+void ULL_init(UnrolledList *target_list){
+    /* Initialize target_list as an empty list. Nothing is allocated */
+    target_list->head_ptr = NULL;
+    target_list->tail_ptr = NULL;
+    target_list->number_of_items = 0;
+    target_list->spare = NULL;
+}
+
+
+void ULL_destroy(UnrolledList *target_list){
+    /* Free all the blocks in the list and leave it empty */
+    UnrolledList_block *block = target_list->head_ptr;
+    while (block){
+        UnrolledList_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(target_list->spare);
+    ULL_init(target_list);
+}
+
+
+size_t ULL_get_num_items(const UnrolledList *target_list){
+    return target_list->number_of_items;
+}
+
+
+bool ULL_is_empty(const UnrolledList *target_list){
+    return target_list->number_of_items == 0;
+}
+
+
+static UnrolledList_block *ULL_get_block(UnrolledList *target_list, unsigned short position){
+    /* Get an empty block, with begin and end both at position */
+    UnrolledList_block *block = target_list->spare;
+    if (block){
+        target_list->spare = NULL;
+    }
+    else{
+        block = aligned_alloc(ULL_CACHE_LINE, sizeof(UnrolledList_block));
+        assert(block != NULL);  // same as LL_build_node: running out of memory is fatal
+    }
+    block->previous = NULL;
+    block->next = NULL;
+    block->begin = position;
+    block->end = position;
+    return block;
+}
+
+
+static void ULL_release_block(UnrolledList *target_list, UnrolledList_block *block){
+    /* Keep block as the spare if there isn't one, or free it */
+    if (target_list->spare){
+        free(block);
+    }
+    else{
+        target_list->spare = block;
+    }
+}
+
+
+void ULL_append(UnrolledList *target_list, char val){
+    /* Append val to the list, i.e. make it the new tail */
+    UnrolledList_block *tail = target_list->tail_ptr;
+
+    if (!tail || tail->end == ULL_BLOCK_CAPACITY){
+        UnrolledList_block *block = ULL_get_block(target_list, 0);     // fill it from the front
+        block->previous = tail;
+        if (tail){
+            tail->next = block;
+        }
+        else{
+            target_list->head_ptr = block;
+        }
+        target_list->tail_ptr = tail = block;
+    }
+    tail->data[tail->end++] = val;
+    target_list->number_of_items++;
+}
+
+
+void ULL_prepend(UnrolledList *target_list, char val){
+    /* Prepend val to the list, i.e. make it the new head */
+    UnrolledList_block *head = target_list->head_ptr;
+
+    if (!head || head->begin == 0){
+        UnrolledList_block *block = ULL_get_block(target_list, ULL_BLOCK_CAPACITY);  // fill it from the back
+        block->next = head;
+        if (head){
+            head->previous = block;
+        }
+        else{
+            target_list->tail_ptr = block;
+        }
+        target_list->head_ptr = head = block;
+    }
+    head->data[--head->begin] = val;
+    target_list->number_of_items++;
+}
+
+
+static void ULL_unlink_head(UnrolledList *target_list){
+    UnrolledList_block *head = target_list->head_ptr;
+    target_list->head_ptr = head->next;
+    if (target_list->head_ptr){
+        target_list->head_ptr->previous = NULL;
+    }
+    else{
+        target_list->tail_ptr = NULL;
+    }
+    ULL_release_block(target_list, head);
+}
+
+
+static void ULL_unlink_tail(UnrolledList *target_list){
+    UnrolledList_block *tail = target_list->tail_ptr;
+    target_list->tail_ptr = tail->previous;
+    if (target_list->tail_ptr){
+        target_list->tail_ptr->next = NULL;
+    }
+    else{
+        target_list->head_ptr = NULL;
+    }
+    ULL_release_block(target_list, tail);
+}
+
+
+char ULL_head_pop(UnrolledList *target_list){
+    /* Remove and return the value of the current head */
+    assert(target_list->number_of_items > 0);
+    UnrolledList_block *head = target_list->head_ptr;
+    char val = head->data[head->begin++];
+    target_list->number_of_items--;
+    if (head->begin == head->end){
+        ULL_unlink_head(target_list);
+    }
+    return val;
+}
+
+
+char ULL_tail_pop(UnrolledList *target_list){
+    /* Remove and return the value of the current tail */
+    assert(target_list->number_of_items > 0);
+    UnrolledList_block *tail = target_list->tail_ptr;
+    char val = tail->data[--tail->end];
+    target_list->number_of_items--;
+    if (tail->begin == tail->end){
+        ULL_unlink_tail(target_list);
+    }
+    return val;
+}
+
+
+char ULL_get(const UnrolledList *target_list, size_t index){
+    /* Return the value at index (0 is the head) without removing it.
+       Walks the blocks, so it's O(index / ULL_BLOCK_CAPACITY).
+    */
+    assert(index < target_list->number_of_items);
+    const UnrolledList_block *block = target_list->head_ptr;
+    for (;;){
+        size_t in_block = block->end - block->begin;
+        if (index < in_block){
+            return block->data[block->begin + index];
+        }
+        index -= in_block;
+        block = block->next;
+    }
+}
+
+
+size_t ULL_copy_to(const UnrolledList *target_list, char buf[], size_t max_items){
+    /* Copy up to max_items values, head first, into buf, one memcpy per
+       block, and return how many were copied. The list isn't changed.
+    */
+    size_t copied = 0;
+    for (const UnrolledList_block *block = target_list->head_ptr; block && copied < max_items; block = block->next){
+        size_t in_block = block->end - block->begin;
+        if (in_block > max_items - copied){
+            in_block = max_items - copied;
+        }
+        memcpy(buf + copied, block->data + block->begin, in_block);
+        copied += in_block;
+    }
+    return copied;
+}
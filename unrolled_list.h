@@ -0,0 +1,54 @@
+#ifndef UNROLLED_LIST_H
+#define UNROLLED_LIST_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* An unrolled deque of chars with the same interface as LinkedList: each
+ * node (block) holds a run of up to ULL_BLOCK_CAPACITY values rather than
+ * a single one, so the pointers are paid for once per block instead of
+ * once per value, and a scan reads consecutive bytes.
+ *
+ * Blocks are ULL_BLOCK_SIZE bytes and aligned to a cache line. Values
+ * in a block sit in data[begin .. end): appending grows end in the tail
+ * block and prepending shrinks begin in the head block, and a new block is
+ * only allocated when the one at that end is full. Unlike LL_prepend(),
+ * ULL_prepend() works on an empty list too.
+ */
+#define ULL_BLOCK_SIZE 256      // bytes per block, header included; a multiple of 64
+#define ULL_CACHE_LINE 64
+
+typedef struct unrolled_list UnrolledList;
+typedef struct unrolled_list_block UnrolledList_block;
+
+struct unrolled_list_block{
+UnrolledList_block *previous;
+UnrolledList_block *next;
+unsigned short begin;
+unsigned short end;
+char data[ULL_BLOCK_SIZE - 2 * sizeof(void *) - 2 * sizeof(unsigned short)];
+};
+
+#define ULL_BLOCK_CAPACITY (sizeof(((UnrolledList_block *)0)->data))
+
+struct unrolled_list{
+UnrolledList_block *head_ptr;
+UnrolledList_block *tail_ptr;
+size_t number_of_items;
+UnrolledList_block *spare;      // one emptied block kept back, so a list hovering at a block boundary doesn't malloc/free on every push/pop
+};
+
+void ULL_init(UnrolledList *target_list);
+void ULL_destroy(UnrolledList *target_list);
+size_t ULL_get_num_items(const UnrolledList *target_list);
+bool ULL_is_empty(const UnrolledList *target_list);
+void ULL_append(UnrolledList *target_list, char val);
+void ULL_prepend(UnrolledList *target_list, char val);
+char ULL_head_pop(UnrolledList *target_list);
+char ULL_tail_pop(UnrolledList *target_list);
+char ULL_get(const UnrolledList *target_list, size_t index);
+size_t ULL_copy_to(const UnrolledList *target_list, char buf[], size_t max_items);
+
+
+#endif